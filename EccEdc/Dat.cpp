@@ -0,0 +1,410 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include "ImageReader.hpp"
+#include "Dat.hpp"
+
+#define DAT_READ_SIZE	(1024 * 1024)
+
+static UINT64 SizeCrcKey(
+	UINT64 ui64Size,
+	UINT uiCrc32
+) {
+	return ui64Size * 0x9e3779b97f4a7c15ull ^ uiCrc32;
+}
+
+static BOOL ParseHex(
+	const std::string& str,
+	LPBYTE lpOut,
+	size_t stSize
+) {
+	if (str.size() != stSize * 2) {
+		return FALSE;
+	}
+	for (size_t i = 0; i < stSize * 2; i++) {
+		CHAR c = str[i];
+		INT n = c >= '0' && c <= '9' ? c - '0' :
+			c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+			c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+		if (n < 0) {
+			return FALSE;
+		}
+		lpOut[i / 2] = (BYTE)(i & 1 ? lpOut[i / 2] << 4 | n : n);
+	}
+	return TRUE;
+}
+
+//
+// Takes the attributes (XML) or the fields (ClrMamePro) of a rom one by one,
+// and adds it to the index once it's complete
+//
+typedef struct _ROM_FIELDS {
+	DAT_ROM rom;
+	BOOL bSize;
+	BOOL bCrc32;
+} ROM_FIELDS, *PROM_FIELDS;
+
+static VOID SetRomField(
+	PROM_FIELDS pFields,
+	const std::string& key,
+	const std::string& value
+) {
+	if (key == "name") {
+		pFields->rom.name = value;
+	}
+	else if (key == "size") {
+		PCHAR endptr = NULL;
+		pFields->rom.ui64Size = strtoull(value.c_str(), &endptr, 10);
+		pFields->bSize = !value.empty() && !*endptr;
+	}
+	else if (key == "crc") {
+		BYTE crc[4] = {};
+		pFields->bCrc32 = ParseHex(value, crc, sizeof(crc));
+		pFields->rom.uiCrc32 = (UINT)crc[0] << 24 | crc[1] << 16 | crc[2] << 8 | crc[3];
+	}
+	else if (key == "md5") {
+		pFields->rom.bMd5 = ParseHex(value, pFields->rom.md5, sizeof(pFields->rom.md5));
+	}
+	else if (key == "sha1") {
+		pFields->rom.bSha1 = ParseHex(value, pFields->rom.sha1, sizeof(pFields->rom.sha1));
+	}
+}
+
+static VOID AddRom(
+	PDAT_INDEX pIndex,
+	PROM_FIELDS pFields,
+	const std::string& game
+) {
+	if (pFields->bSize && pFields->bCrc32) {
+		pFields->rom.game = game;
+		pIndex->bySizeCrc.emplace(SizeCrcKey(pFields->rom.ui64Size, pFields->rom.uiCrc32), pIndex->roms.size());
+		pIndex->roms.push_back(pFields->rom);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Logiqx XML: <game name="..."> (or <machine>) holding <rom name="..."
+// size="..." crc="..." md5="..." sha1="..."/>
+//
+////////////////////////////////////////////////////////////////////////////////
+static VOID AppendUtf8(
+	std::string& str,
+	ULONG ulCode
+) {
+	if (ulCode < 0x80) {
+		str += (CHAR)ulCode;
+	}
+	else if (ulCode < 0x800) {
+		str += (CHAR)(0xc0 | ulCode >> 6);
+		str += (CHAR)(0x80 | (ulCode & 0x3f));
+	}
+	else if (ulCode < 0x10000) {
+		str += (CHAR)(0xe0 | ulCode >> 12);
+		str += (CHAR)(0x80 | ((ulCode >> 6) & 0x3f));
+		str += (CHAR)(0x80 | (ulCode & 0x3f));
+	}
+	else {
+		str += (CHAR)(0xf0 | ulCode >> 18);
+		str += (CHAR)(0x80 | ((ulCode >> 12) & 0x3f));
+		str += (CHAR)(0x80 | ((ulCode >> 6) & 0x3f));
+		str += (CHAR)(0x80 | (ulCode & 0x3f));
+	}
+}
+
+static std::string DecodeXml(
+	const CHAR* pBegin,
+	const CHAR* pEnd
+) {
+	static const struct {
+		LPCSTR pszName;
+		CHAR c;
+	} entities[] = {
+		{ "amp;", '&' }, { "lt;", '<' }, { "gt;", '>' }, { "quot;", '"' }, { "apos;", '\'' },
+	};
+	std::string str;
+
+	for (const CHAR* p = pBegin; p < pEnd; p++) {
+		if (*p != '&') {
+			str += *p;
+			continue;
+		}
+		BOOL bDecoded = FALSE;
+		for (size_t i = 0; i < sizeof(entities) / sizeof(entities[0]); i++) {
+			size_t stLen = strlen(entities[i].pszName);
+			if ((size_t)(pEnd - p - 1) >= stLen && !strncmp(p + 1, entities[i].pszName, stLen)) {
+				str += entities[i].c;
+				p += stLen;
+				bDecoded = TRUE;
+				break;
+			}
+		}
+		if (!bDecoded && p + 1 < pEnd && p[1] == '#') {
+			PCHAR endptr = NULL;
+			BOOL bHex = p + 2 < pEnd && (p[2] == 'x' || p[2] == 'X');
+			ULONG ulCode = strtoul(p + (bHex ? 3 : 2), &endptr, bHex ? 16 : 10);
+			if (endptr < pEnd && *endptr == ';' && ulCode && ulCode < 0x110000) {
+				AppendUtf8(str, ulCode);
+				p = endptr;
+				bDecoded = TRUE;
+			}
+		}
+		if (!bDecoded) {
+			str += *p;
+		}
+	}
+	return str;
+}
+
+static BOOL IsSpace(
+	CHAR c
+) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static VOID ParseXmlDat(
+	const std::string& data,
+	PDAT_INDEX pIndex
+) {
+	const CHAR* p = data.c_str();
+	const CHAR* pEnd = p + data.size();
+	std::string game;
+
+	while (NULL != (p = (const CHAR*)memchr(p, '<', (size_t)(pEnd - p)))) {
+		if (!strncmp(p, "<!--", 4)) {
+			const CHAR* pClose = strstr(p + 4, "-->");
+			p = pClose ? pClose + 3 : pEnd;
+			continue;
+		}
+		const CHAR* pName = ++p;
+		while (p < pEnd && !IsSpace(*p) && *p != '>' && *p != '/') {
+			p++;
+		}
+		std::string tag(pName, p);
+		BOOL bGame = tag == "game" || tag == "machine";
+		BOOL bRom = tag == "rom";
+		ROM_FIELDS fields = {};
+
+		// attributes, up to the end of the tag
+		while (p < pEnd && *p != '>') {
+			if (IsSpace(*p) || *p == '/') {
+				p++;
+				continue;
+			}
+			const CHAR* pKey = p;
+			while (p < pEnd && *p != '=' && *p != '>' && !IsSpace(*p)) {
+				p++;
+			}
+			std::string key(pKey, p);
+			while (p < pEnd && IsSpace(*p)) {
+				p++;
+			}
+			if (p >= pEnd || *p != '=') {
+				continue;
+			}
+			p++;
+			while (p < pEnd && IsSpace(*p)) {
+				p++;
+			}
+			if (p >= pEnd || (*p != '"' && *p != '\'')) {
+				continue;
+			}
+			CHAR quote = *p++;
+			const CHAR* pValue = p;
+			while (p < pEnd && *p != quote) {
+				p++;
+			}
+			std::string value = DecodeXml(pValue, p);
+			if (p < pEnd) {
+				p++;
+			}
+			if (bGame && key == "name") {
+				game = value;
+			}
+			else if (bRom) {
+				SetRomField(&fields, key, value);
+			}
+		}
+		if (bRom) {
+			AddRom(pIndex, &fields, game);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ClrMamePro: game ( name "..." rom ( name "..." size ... crc ... ) )
+//
+////////////////////////////////////////////////////////////////////////////////
+typedef struct _CMP_LEXER {
+	const CHAR* p;
+	const CHAR* pEnd;
+} CMP_LEXER, *PCMP_LEXER;
+
+// "(" or ")", a quoted string without the quotes, or a word; FALSE at the end
+static BOOL NextCmpToken(
+	PCMP_LEXER pLexer,
+	std::string& token,
+	PBOOL pbQuoted
+) {
+	const CHAR* p = pLexer->p;
+	while (p < pLexer->pEnd && IsSpace(*p)) {
+		p++;
+	}
+	if (p >= pLexer->pEnd) {
+		pLexer->p = p;
+		return FALSE;
+	}
+	const CHAR* pBegin = p;
+	*pbQuoted = FALSE;
+	if (*p == '(' || *p == ')') {
+		p++;
+	}
+	else if (*p == '"') {
+		pBegin = ++p;
+		while (p < pLexer->pEnd && *p != '"') {
+			p++;
+		}
+		token.assign(pBegin, p);
+		*pbQuoted = TRUE;
+		pLexer->p = p < pLexer->pEnd ? p + 1 : p;
+		return TRUE;
+	}
+	else {
+		while (p < pLexer->pEnd && !IsSpace(*p) && *p != '(' && *p != ')') {
+			p++;
+		}
+	}
+	token.assign(pBegin, p);
+	pLexer->p = p;
+	return TRUE;
+}
+
+// After the "(" of a block that isn't needed
+static VOID SkipCmpBlock(
+	PCMP_LEXER pLexer
+) {
+	std::string token;
+	BOOL bQuoted = FALSE;
+	INT nDepth = 1;
+
+	while (nDepth && NextCmpToken(pLexer, token, &bQuoted)) {
+		if (!bQuoted && token == "(") {
+			nDepth++;
+		}
+		else if (!bQuoted && token == ")") {
+			nDepth--;
+		}
+	}
+}
+
+static VOID ParseCmpDat(
+	const std::string& data,
+	PDAT_INDEX pIndex
+) {
+	CMP_LEXER lexer = { data.c_str(), data.c_str() + data.size() };
+	std::string token;
+	std::string key;
+	BOOL bQuoted = FALSE;
+
+	while (NextCmpToken(&lexer, key, &bQuoted)) {
+		if (!NextCmpToken(&lexer, token, &bQuoted)) {
+			break;
+		}
+		if (bQuoted || token != "(") {
+			continue;
+		}
+		if (key != "game" && key != "machine" && key != "resource") {
+			SkipCmpBlock(&lexer);
+			continue;
+		}
+		std::string game;
+		while (NextCmpToken(&lexer, key, &bQuoted) && !(!bQuoted && key == ")")) {
+			if (!NextCmpToken(&lexer, token, &bQuoted)) {
+				break;
+			}
+			if (bQuoted || token != "(") {
+				if (key == "name") {
+					game = token;
+				}
+				continue;
+			}
+			if (key != "rom") {
+				SkipCmpBlock(&lexer);
+				continue;
+			}
+			ROM_FIELDS fields = {};
+			while (NextCmpToken(&lexer, key, &bQuoted) && !(!bQuoted && key == ")")) {
+				if (!NextCmpToken(&lexer, token, &bQuoted)) {
+					break;
+				}
+				if (!bQuoted && token == "(") {
+					SkipCmpBlock(&lexer);
+					continue;
+				}
+				SetRomField(&fields, key, token);
+			}
+			AddRom(pIndex, &fields, game);
+		}
+	}
+}
+
+BOOL LoadDat(
+	LPCSTR pszPath,
+	PDAT_INDEX pIndex
+) {
+	FILE* fp = fopen(pszPath, "rb");
+	if (!fp) {
+		return FALSE;
+	}
+	IMAGE_READER reader;
+	std::string data;
+	LPBYTE lpBuf = NULL;
+	size_t stRead = 0;
+
+	OpenImageReader(&reader, fp, 0, 0, NULL);
+	while (NULL != (lpBuf = ReadImage(&reader, DAT_READ_SIZE, &stRead))) {
+		data.append((const CHAR*)lpBuf, stRead);
+	}
+	CloseImageReader(&reader);
+	fclose(fp);
+
+	size_t stFirst = data.find_first_not_of(" \t\r\n\xef\xbb\xbf");
+	if (stFirst != std::string::npos && data[stFirst] == '<') {
+		ParseXmlDat(data, pIndex);
+	}
+	else {
+		ParseCmpDat(data, pIndex);
+	}
+	return !pIndex->roms.empty();
+}
+
+const DAT_ROM* FindDatRom(
+	const DAT_INDEX* pIndex,
+	const HASH_DIGESTS* pDigests
+) {
+	auto range = pIndex->bySizeCrc.equal_range(SizeCrcKey(pDigests->ui64Size, pDigests->uiCrc32));
+
+	for (auto it = range.first; it != range.second; ++it) {
+		const DAT_ROM* pRom = &pIndex->roms[it->second];
+		if (pRom->ui64Size == pDigests->ui64Size && pRom->uiCrc32 == pDigests->uiCrc32 &&
+			(!pRom->bMd5 || !memcmp(pRom->md5, pDigests->md5, sizeof(pRom->md5))) &&
+			(!pRom->bSha1 || !memcmp(pRom->sha1, pDigests->sha1, sizeof(pRom->sha1)))) {
+			return pRom;
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,50 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _DAT_HPP_
+#define _DAT_HPP_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "Hash.hpp"
+
+//
+// The roms of a redump DAT (Logiqx XML or ClrMamePro), looked up by size and
+// crc32; md5 and sha-1 must match too when the DAT has them
+//
+typedef struct _DAT_ROM {
+	std::string game;
+	std::string name;
+	UINT64 ui64Size;
+	UINT uiCrc32;
+	BYTE md5[16];
+	BYTE sha1[20];
+	BOOL bMd5;
+	BOOL bSha1;
+} DAT_ROM, *PDAT_ROM;
+
+typedef struct _DAT_INDEX {
+	std::vector<DAT_ROM> roms;
+	std::unordered_multimap<UINT64, size_t> bySizeCrc;
+} DAT_INDEX, *PDAT_INDEX;
+
+// FALSE when the file can't be read or has no rom with a size and crc
+BOOL LoadDat(LPCSTR pszPath, PDAT_INDEX pIndex);
+// NULL when no rom matches
+const DAT_ROM* FindDatRom(const DAT_INDEX* pIndex, const HASH_DIGESTS* pDigests);
+
+#endif
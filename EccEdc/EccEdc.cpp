@@ -17,12 +17,43 @@
 #ifdef _WIN32
 #include "StringUtils.hpp"
 #include "FileUtils.hpp"
+#include <io.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
 #endif
 #include "Enum.h"
+#include "ImageReader.hpp"
+#include "Hash.hpp"
+#include "Dat.hpp"
+#include "SpscQueue.hpp"
 #include "_external/ecm.h"
+#include <sys/stat.h>
+#include <cstdarg>
+#include <deque>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 static UINT check_fix_mode_s_startLBA = 0;
 static UINT check_fix_mode_s_endLBA = 0;
+static BOOL check_fix_mode_s_IoUring = FALSE;
+static UINT check_fix_mode_s_QueueDepth = 16;
+static UINT check_fix_mode_s_Jobs = 1;
+static LOG_LEVEL check_fix_mode_s_LogLevel = logLevelFull;
+static REPORT_TYPE check_fix_mode_s_Report = reportNone;
+static BOOL check_fix_mode_s_Hash = FALSE;
+static BOOL check_fix_mode_s_Sha256 = FALSE;
+// set by verifydat, and the rom that the last image checked matched
+static PDAT_INDEX check_fix_mode_s_pDat = NULL;
+static const DAT_ROM* check_fix_mode_s_pDatRom = NULL;
+// fix/correct write to a copy of the image instead
+static LPCSTR check_fix_mode_s_pszOutput = NULL;
+// fix/correct write what they would change to a patch instead
+static LPCSTR check_fix_mode_s_pszPatch = NULL;
 static BYTE write_mode_s_Minute = 0;
 static BYTE write_mode_s_Second = 0;
 static BYTE write_mode_s_Frame = 0;
@@ -45,23 +76,53 @@ typedef struct _ERROR_STRUCT {
 	INT cnt_UnknownMode = 0; // For SecuROM
 	INT cnt_ZeroSync = 0;
 	INT cnt_ZeroSyncPregap = 0;
-	DWORD* badMsfNum;
-	DWORD* notAllZeroNum;
-	DWORD* errorNum;
-	DWORD* noMatchLBANum;
-	DWORD* reservedNum;
-	DWORD* noEDCNum;
-	DWORD* mode2Form1Num;
-	DWORD* mode2Form2Num;
-	DWORD* mode2Num;
-	DWORD* invalidModeNum;
-	DWORD* nonZeroInvalidSyncNum;
-	DWORD* zeroSyncNum;
-	DWORD* zeroSyncPregapNum;
-	DWORD* unknownModeNum;
+	// sectors of each kind, as many as were found
+	std::vector<DWORD> badMsfNum;
+	std::vector<DWORD> notAllZeroNum;
+	std::vector<DWORD> errorNum;
+	std::vector<DWORD> noMatchLBANum;
+	std::vector<DWORD> reservedNum;
+	std::vector<DWORD> noEDCNum;
+	std::vector<DWORD> mode2Form1Num;
+	std::vector<DWORD> mode2Form2Num;
+	std::vector<DWORD> mode2Num;
+	std::vector<DWORD> invalidModeNum;
+	std::vector<DWORD> nonZeroInvalidSyncNum;
+	std::vector<DWORD> zeroSyncNum;
+	std::vector<DWORD> zeroSyncPregapNum;
+	std::vector<DWORD> unknownModeNum;
 } ERROR_STRUCT, *PERROR_STRUCT;
 
+//
+// All that the sequential pass of check needs from a sector, so that sectors
+// can be classified on other threads and dropped before that pass reaches them
+//
+typedef struct _SECTOR_RESULT {
+	SectorType sectorType;
+	TrackMode trackMode;
+	BOOL bFilled55;
+	BYTE msf[3];       // 0x0c - 0x0e
+	BYTE mode;         // 0x0f
+	BYTE subheader[8]; // 0x10 - 0x17
+	BYTE reserved[8];  // 0x814 - 0x81b
+	BYTE subQ[3];      // 0x0c - 0x0e of .sub (ctl/adr, track, index), zero without it
+} SECTOR_RESULT, *PSECTOR_RESULT;
+
+typedef struct _CHECK_WINDOW {
+	std::vector<SECTOR_RESULT> results;
+	size_t stSectors;  // 0 ends the check
+	BOOL bLast;        // holds the last sector of the image
+} CHECK_WINDOW, *PCHECK_WINDOW;
+
 #define CD_RAW_SECTOR_SIZE	(2352)
+#define CHECK_BATCH_SECTORS	(256)
+#define READ_AHEAD_CHUNK_SIZE	(CHECK_BATCH_SECTORS * CD_RAW_SECTOR_SIZE * 8) // about 4.6 MiB
+#define READ_AHEAD_CHUNKS	(4)
+#define CHECK_SLICE_SECTORS	(32)  // taken at a time by a classifier thread
+#define CHECK_STREAM_WINDOWS	(64)  // queued for the log when the size isn't known
+#define FIX_RUN_SECTORS	(256) // adjacent sectors written back at once by fix
+#define COPY_CHUNK_SIZE	(1024 * 1024)
+#define PROGRESS_INTERVAL_MS	(100)
 
 #define OutputString(str, ...)		printf(str, ##__VA_ARGS__);
 #define OutputErrorString(str, ...)	fprintf(stderr, str, ##__VA_ARGS__);
@@ -157,17 +218,38 @@ BOOL IsErrorSector(
 	return bRet;
 }
 
-LONG GetFileSize(
-	LONG lOffset,
+//
+// Size of a regular file from its metadata, without seeking; 0 for anything
+// else (a pipe), which is still read to its end, just without a total
+//
+UINT64 GetImageSize(
 	FILE *fp
 ) {
-	LONG lFileSize = 0;
-	if (fp != NULL) {
-		fseek(fp, 0, SEEK_END);
-		lFileSize = ftell(fp);
-		fseek(fp, lOffset, SEEK_SET);
+#ifdef _WIN32
+	struct _stat64 st = {};
+	if (_fstat64(_fileno(fp), &st) || !(st.st_mode & _S_IFREG)) {
+		return 0;
 	}
-	return lFileSize;
+#else
+	struct stat st = {};
+	if (fstat(fileno(fp), &st) || !S_ISREG(st.st_mode)) {
+		return 0;
+	}
+#endif
+	return (UINT64)st.st_size;
+}
+
+// fseek with an offset that doesn't wrap past 2 GiB where LONG is 32-bit
+INT Fseek64(
+	FILE *fp,
+	INT64 n64Offset,
+	INT nOrigin
+) {
+#ifdef _WIN32
+	return _fseeki64(fp, n64Offset, nOrigin);
+#else
+	return fseeko(fp, (off_t)n64Offset, nOrigin);
+#endif
 }
 
 INT MSFtoLBA(
@@ -207,170 +289,953 @@ BYTE DecToBcd(
 	return (BYTE)(m << 4 | n);
 }
 
-INT fixSectorsFromArray(
-	EXEC_TYPE execType,
+// pread/pwrite where there are, so the stream's position and buffer don't
+// matter to fix
+BOOL ReadImageAt(
 	FILE *fp,
-	DWORD *errorSectors,
-	INT sectorCount,
-	DWORD startLBA,
-	DWORD endLBA
+	UINT64 ui64Offset,
+	LPBYTE lpBuf,
+	size_t stSize
 ) {
-#ifndef _WIN32
-	UNREFERENCED_PARAMETER(execType);
+#ifdef _WIN32
+	return !Fseek64(fp, (INT64)ui64Offset, SEEK_SET) &&
+		fread(lpBuf, sizeof(BYTE), stSize, fp) == stSize;
+#else
+	while (stSize) {
+		ssize_t ssRead = pread(fileno(fp), lpBuf, stSize, (off_t)ui64Offset);
+		if (ssRead <= 0) {
+			if (ssRead < 0 && errno == EINTR) {
+				continue;
+			}
+			return FALSE;
+		}
+		lpBuf += ssRead;
+		stSize -= (size_t)ssRead;
+		ui64Offset += (UINT64)ssRead;
+	}
+	return TRUE;
 #endif
-	INT fixedCount = 0;
+}
 
-	for (INT i = 0; i < sectorCount; i++) {
-		if (startLBA <= errorSectors[i] && errorSectors[i] <= endLBA) {
+BOOL WriteImageAt(
+	FILE *fp,
+	UINT64 ui64Offset,
+	const BYTE* lpBuf,
+	size_t stSize
+) {
 #ifdef _WIN32
-			if (execType == checkex) {
-				fseek(fp, (LONG)((errorSectors[i] - startLBA) * CD_RAW_SECTOR_SIZE + 12), SEEK_SET);
+	return !Fseek64(fp, (INT64)ui64Offset, SEEK_SET) &&
+		fwrite(lpBuf, sizeof(BYTE), stSize, fp) == stSize;
+#else
+	while (stSize) {
+		ssize_t ssWritten = pwrite(fileno(fp), lpBuf, stSize, (off_t)ui64Offset);
+		if (ssWritten <= 0) {
+			if (ssWritten < 0 && errno == EINTR) {
+				continue;
 			}
-			else {
+			return FALSE;
+		}
+		lpBuf += ssWritten;
+		stSize -= (size_t)ssWritten;
+		ui64Offset += (UINT64)ssWritten;
+	}
+	return TRUE;
 #endif
-				fseek(fp, (LONG)(errorSectors[i] * CD_RAW_SECTOR_SIZE + 12), SEEK_SET);
+}
+
+BOOL SyncImage(
+	FILE *fp
+) {
+#ifdef _WIN32
+	return !fflush(fp) && !_commit(_fileno(fp));
+#else
+	return !fsync(fileno(fp));
+#endif
+}
+
+//
+// Copies the image for fix --output, as cheaply as the file system allows:
+// a reflink (FICLONE) shares the blocks and costs nothing, copy_file_range and
+// sendfile at least stay in the kernel, and read/write is the last resort
+// Returns how it was copied, or NULL
+//
+LPCSTR CopyImage(
+	FILE *fpSrc,
+	LPCSTR pszSrcPath,
+	LPCSTR pszOutPath
+) {
 #ifdef _WIN32
+	CHAR szSrc[_MAX_PATH] = {};
+	CHAR szOut[_MAX_PATH] = {};
+	UNREFERENCED_PARAMETER(fpSrc);
+	if (!_fullpath(szSrc, pszSrcPath, _MAX_PATH) || !_fullpath(szOut, pszOutPath, _MAX_PATH) ||
+		!_stricmp(szSrc, szOut)) {
+		return NULL;
+	}
+	// block cloning where the file system has it (ReFS)
+	return CopyFileA(pszSrcPath, pszOutPath, FALSE) ? "CopyFile" : NULL;
+#else
+	UNREFERENCED_PARAMETER(pszSrcPath);
+	INT fdSrc = fileno(fpSrc);
+	struct stat stSrc = {};
+	struct stat stOut = {};
+	if (fstat(fdSrc, &stSrc) ||
+		(!stat(pszOutPath, &stOut) && stSrc.st_dev == stOut.st_dev && stSrc.st_ino == stOut.st_ino)) {
+		// never truncate the image itself
+		errno = EINVAL;
+		return NULL;
+	}
+	INT fdOut = open(pszOutPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fdOut < 0) {
+		return NULL;
+	}
+	LPCSTR pszHow = NULL;
+	UINT64 ui64Size = (UINT64)stSrc.st_size;
+	UINT64 ui64Done = 0;
+#ifdef FICLONE
+	if (!ioctl(fdOut, FICLONE, fdSrc)) {
+		pszHow = "reflink";
+		ui64Done = ui64Size;
+	}
+#endif
+#ifdef __NR_copy_file_range
+	if (!pszHow) {
+		pszHow = "copy_file_range";
+		while (ui64Done < ui64Size) {
+			loff_t offSrc = (loff_t)ui64Done;
+			loff_t offOut = (loff_t)ui64Done;
+			long lCopied = syscall(__NR_copy_file_range, fdSrc, &offSrc, fdOut, &offOut
+				, (size_t)(ui64Size - ui64Done < COPY_CHUNK_SIZE * 64 ? ui64Size - ui64Done : COPY_CHUNK_SIZE * 64), 0);
+			if (lCopied <= 0) {
+				break;
 			}
+			ui64Done += (UINT64)lCopied;
+		}
+	}
 #endif
-			BYTE m, s, f;
-			LBAtoMSF((INT)errorSectors[i] + 150, &m, &s, &f);
+#ifdef __linux__
+	if (ui64Done < ui64Size) {
+		// older kernels, or across file systems
+		pszHow = "sendfile";
+		while (ui64Done < ui64Size) {
+			off_t offSrc = (off_t)ui64Done;
+			if (lseek(fdOut, (off_t)ui64Done, SEEK_SET) < 0) {
+				break;
+			}
+			ssize_t ssCopied = sendfile(fdOut, fdSrc, &offSrc
+				, (size_t)(ui64Size - ui64Done < COPY_CHUNK_SIZE * 64 ? ui64Size - ui64Done : COPY_CHUNK_SIZE * 64));
+			if (ssCopied <= 0) {
+				break;
+			}
+			ui64Done += (UINT64)ssCopied;
+		}
+	}
+#endif
+	if (ui64Done < ui64Size) {
+		pszHow = "read/write";
+		std::vector<BYTE> buf(COPY_CHUNK_SIZE);
+		FILE* fpOut = fdopen(dup(fdOut), "wb");
+		while (fpOut && ui64Done < ui64Size) {
+			size_t stSize = ui64Size - ui64Done < COPY_CHUNK_SIZE ? (size_t)(ui64Size - ui64Done) : COPY_CHUNK_SIZE;
+			if (!ReadImageAt(fpSrc, ui64Done, buf.data(), stSize) ||
+				!WriteImageAt(fpOut, ui64Done, buf.data(), stSize)) {
+				break;
+			}
+			ui64Done += stSize;
+		}
+		if (fpOut) {
+			fclose(fpOut);
+		}
+	}
+	if (close(fdOut) || ui64Done < ui64Size) {
+		return NULL;
+	}
+	return pszHow;
+#endif
+}
+
+//
+// fix --patch writes, and applypatch reads: "EccEdcP1", the image size, then a
+// record of each run of sectors (type, LBA, count and the crc32 of what the
+// image holds there before it's patched), an end record and the crc32 of all
+// of it. A run replaced at 0x55 is only its record, a sector corrected by ecc
+// the spans of bytes that changed
+// The undo journal of an in-place fix is a patch too, of the sectors as they
+// were before it
+//
+#define PATCH_MAGIC "EccEdcP1"
+#define PATCH_MAGIC_SIZE (8)
+#define PATCH_SPAN_GAP (8)
+
+typedef struct _PATCH_RUN {
+	PATCH_RECORD type;
+	DWORD dwLBA;
+	DWORD dwCount;
+	UINT uiCrc32;
+	size_t stData;
+	size_t stDataSize;
+	BOOL bHeld;
+} PATCH_RUN, *PPATCH_RUN;
+
+VOID appendPatchValue(
+	std::string& patch,
+	UINT64 ui64Value,
+	size_t stBytes
+) {
+	for (size_t i = 0; i < stBytes; i++) {
+		patch += (CHAR)(BYTE)(ui64Value >> (i * 8));
+	}
+}
 
-			fputc(DecToBcd(m), fp);
-			fputc(DecToBcd(s), fp);
-			fputc(DecToBcd(f), fp);
+BOOL readPatchValue(
+	const std::string& patch,
+	size_t* pPos,
+	size_t stBytes,
+	PUINT64 pValue
+) {
+	if (*pPos > patch.size() || patch.size() - *pPos < stBytes) {
+		return FALSE;
+	}
+	*pValue = 0;
+	for (size_t i = 0; i < stBytes; i++) {
+		*pValue |= (UINT64)(BYTE)patch[*pPos + i] << (i * 8);
+	}
+	*pPos += stBytes;
+	return TRUE;
+}
 
-			fseek(fp, 1, SEEK_CUR);
+VOID beginPatch(
+	std::string& patch,
+	UINT64 ui64ImageSize
+) {
+	patch.assign(PATCH_MAGIC, PATCH_MAGIC_SIZE);
+	appendPatchValue(patch, ui64ImageSize, sizeof(UINT64));
+}
 
-			for (INT j = 0; j < 2336; j++) {
-				fputc(0x55, fp);
+//
+// lpOriginal and lpPatched are dwCount sectors; a patchBytes record is one
+// sector, whose spans close gaps shorter than a span header, and a
+// patchSectors record holds all of lpPatched
+//
+VOID appendPatchRecord(
+	std::string& patch,
+	PATCH_RECORD type,
+	DWORD dwLBA,
+	DWORD dwCount,
+	const BYTE* lpOriginal,
+	const BYTE* lpPatched
+) {
+	appendPatchValue(patch, (UINT64)type, 1);
+	appendPatchValue(patch, dwLBA, sizeof(UINT));
+	appendPatchValue(patch, dwCount, sizeof(UINT));
+	appendPatchValue(patch, Crc32Update(0, lpOriginal, (size_t)dwCount * CD_RAW_SECTOR_SIZE), sizeof(UINT));
+	if (type == patchSectors) {
+		patch.append((const CHAR*)lpPatched, (size_t)dwCount * CD_RAW_SECTOR_SIZE);
+		return;
+	}
+	if (type != patchBytes) {
+		return;
+	}
+	size_t stCountPos = patch.size();
+	UINT uiSpans = 0;
+	appendPatchValue(patch, 0, sizeof(WORD));
+	for (size_t i = 0; i < CD_RAW_SECTOR_SIZE;) {
+		if (lpOriginal[i] == lpPatched[i]) {
+			i++;
+			continue;
+		}
+		size_t stEnd = i + 1;
+		for (size_t stSame = 0; stEnd + stSame < CD_RAW_SECTOR_SIZE && stSame < PATCH_SPAN_GAP;) {
+			if (lpOriginal[stEnd + stSame] == lpPatched[stEnd + stSame]) {
+				stSame++;
+			}
+			else {
+				stEnd += stSame + 1;
+				stSame = 0;
 			}
-
-			fixedCount++;
 		}
+		appendPatchValue(patch, i, sizeof(WORD));
+		appendPatchValue(patch, stEnd - i, sizeof(WORD));
+		patch.append((const CHAR*)lpPatched + i, stEnd - i);
+		uiSpans++;
+		i = stEnd;
 	}
+	patch[stCountPos] = (CHAR)(BYTE)uiSpans;
+	patch[stCountPos + 1] = (CHAR)(BYTE)(uiSpans >> 8);
+}
 
-	return fixedCount;
+VOID endPatch(
+	std::string& patch
+) {
+	appendPatchValue(patch, patchEnd, 1);
+	appendPatchValue(patch, Crc32Update(0, (const BYTE*)patch.data(), patch.size()), sizeof(UINT));
 }
 
-INT initCountNum(
-	PERROR_STRUCT pErrStruct,
-	size_t stAllocSize
+BOOL writePatch(
+	LPCSTR pszPath,
+	const std::string& patch
 ) {
-	if (NULL == ((*pErrStruct).badMsfNum = (DWORD*)calloc(stAllocSize, sizeof(DWORD)))) {
-		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+	FILE* fpPatch = fopen(pszPath, "wb");
+	if (!fpPatch) {
 		return FALSE;
 	}
-	if (NULL == ((*pErrStruct).notAllZeroNum = (DWORD*)calloc(stAllocSize, sizeof(DWORD)))) {
-		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
-		return FALSE;
+	BOOL bRet = fwrite(patch.data(), sizeof(CHAR), patch.size(), fpPatch) == patch.size() &&
+		!fflush(fpPatch) && SyncImage(fpPatch);
+	if (fclose(fpPatch)) {
+		bRet = FALSE;
 	}
-	if (NULL == ((*pErrStruct).errorNum = (DWORD*)calloc(stAllocSize, sizeof(DWORD)))) {
-		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+	return bRet;
+}
+
+BOOL readPatch(
+	LPCSTR pszPath,
+	std::string& patch
+) {
+	FILE* fpPatch = fopen(pszPath, "rb");
+	if (!fpPatch) {
 		return FALSE;
 	}
-	if (NULL == ((*pErrStruct).noMatchLBANum = (DWORD*)calloc(stAllocSize, sizeof(DWORD)))) {
-		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
-		return FALSE;
+	CHAR buf[65536];
+	size_t stRead = 0;
+	patch.clear();
+	while ((stRead = fread(buf, sizeof(CHAR), sizeof(buf), fpPatch)) > 0) {
+		patch.append(buf, stRead);
 	}
-	if (NULL == ((*pErrStruct).reservedNum = (DWORD*)calloc(stAllocSize, sizeof(DWORD)))) {
-		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+	BOOL bRet = !ferror(fpPatch);
+	fclose(fpPatch);
+	return bRet;
+}
+
+//
+// Checks the whole patch, and the crc32 of every run in the image, before it
+// writes anything; so a patch that isn't for this image, or was already
+// applied, leaves it as it is
+// A run of a journal that the image already holds is skipped, so unfix can be
+// run again after it was interrupted
+//
+BOOL applyPatch(
+	FILE *fp,
+	const std::string& patch,
+	LPDWORD lpSectors
+) {
+	UINT64 ui64Value = 0;
+	size_t stPos = PATCH_MAGIC_SIZE;
+
+	if (patch.size() < PATCH_MAGIC_SIZE + sizeof(UINT64) + 1 + sizeof(UINT) ||
+		memcmp(patch.data(), PATCH_MAGIC, PATCH_MAGIC_SIZE)) {
+		OutputErrorString("Not a patch of EccEdc\n");
 		return FALSE;
 	}
-	if (NULL == ((*pErrStruct).noEDCNum = (DWORD*)calloc(stAllocSize, sizeof(DWORD)))) {
-		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+	size_t stBody = patch.size() - sizeof(UINT);
+	size_t stTail = stBody;
+	readPatchValue(patch, &stTail, sizeof(UINT), &ui64Value);
+	if ((UINT)ui64Value != Crc32Update(0, (const BYTE*)patch.data(), stBody)) {
+		OutputErrorString("The patch is damaged (crc32)\n");
 		return FALSE;
 	}
-	if (NULL == ((*pErrStruct).mode2Form1Num = (DWORD*)calloc(stAllocSize, sizeof(DWORD)))) {
-		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+	readPatchValue(patch, &stPos, sizeof(UINT64), &ui64Value);
+	if (ui64Value != GetImageSize(fp)) {
+		OutputErrorString("The patch is for an image of %llu bytes\n", (unsigned long long)ui64Value);
 		return FALSE;
 	}
-	if (NULL == ((*pErrStruct).mode2Form2Num = (DWORD*)calloc(stAllocSize, sizeof(DWORD)))) {
-		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
-		return FALSE;
+
+	std::vector<PATCH_RUN> runs;
+	for (;;) {
+		PATCH_RUN run = {};
+		if (!readPatchValue(patch, &stPos, 1, &ui64Value) || stPos > stBody) {
+			OutputErrorString("The patch has no end\n");
+			return FALSE;
+		}
+		run.type = (PATCH_RECORD)ui64Value;
+		if (run.type == patchEnd) {
+			if (stPos != stBody) {
+				OutputErrorString("The patch has data after its end\n");
+				return FALSE;
+			}
+			break;
+		}
+		UINT64 ui64LBA = 0;
+		UINT64 ui64Count = 0;
+		if (!readPatchValue(patch, &stPos, sizeof(UINT), &ui64LBA) ||
+			!readPatchValue(patch, &stPos, sizeof(UINT), &ui64Count) ||
+			!readPatchValue(patch, &stPos, sizeof(UINT), &ui64Value) ||
+			ui64Count == 0 || ui64Count > FIX_RUN_SECTORS ||
+			(run.type != patchFill55 && run.type != patchBytes && run.type != patchSectors) ||
+			(run.type == patchBytes && ui64Count != 1)) {
+			OutputErrorString("The patch has an invalid record\n");
+			return FALSE;
+		}
+		run.dwLBA = (DWORD)ui64LBA;
+		run.dwCount = (DWORD)ui64Count;
+		run.uiCrc32 = (UINT)ui64Value;
+		if (run.type == patchBytes) {
+			UINT64 ui64Spans = 0;
+			UINT64 ui64Offset = 0;
+			UINT64 ui64Size = 0;
+			if (!readPatchValue(patch, &stPos, sizeof(WORD), &ui64Spans)) {
+				OutputErrorString("The patch has an invalid record\n");
+				return FALSE;
+			}
+			run.stData = stPos;
+			for (UINT64 i = 0; i < ui64Spans; i++) {
+				if (!readPatchValue(patch, &stPos, sizeof(WORD), &ui64Offset) ||
+					!readPatchValue(patch, &stPos, sizeof(WORD), &ui64Size) ||
+					ui64Offset + ui64Size > CD_RAW_SECTOR_SIZE || stPos > stBody || stBody - stPos < ui64Size) {
+					OutputErrorString("The patch has an invalid record\n");
+					return FALSE;
+				}
+				stPos += (size_t)ui64Size;
+			}
+			run.stDataSize = stPos - run.stData;
+		}
+		else if (run.type == patchSectors) {
+			run.stData = stPos;
+			run.stDataSize = (size_t)run.dwCount * CD_RAW_SECTOR_SIZE;
+			if (stPos > stBody || stBody - stPos < run.stDataSize) {
+				OutputErrorString("The patch has an invalid record\n");
+				return FALSE;
+			}
+			stPos += run.stDataSize;
+		}
+		if (stPos > stBody) {
+			OutputErrorString("The patch has an invalid record\n");
+			return FALSE;
+		}
+		runs.push_back(run);
 	}
-	if (NULL == ((*pErrStruct).mode2Num = (DWORD*)calloc(stAllocSize, sizeof(DWORD)))) {
-		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
-		return FALSE;
+
+	std::vector<BYTE> buf((size_t)FIX_RUN_SECTORS * CD_RAW_SECTOR_SIZE);
+	for (size_t i = 0; i < runs.size(); i++) {
+		size_t stBytes = (size_t)runs[i].dwCount * CD_RAW_SECTOR_SIZE;
+		if (!ReadImageAt(fp, (UINT64)runs[i].dwLBA * CD_RAW_SECTOR_SIZE, buf.data(), stBytes)) {
+			OutputErrorString("LBA[%06d, %#07x]: can't be read\n", (INT)runs[i].dwLBA, (INT)runs[i].dwLBA);
+			return FALSE;
+		}
+		UINT uiCrc32 = Crc32Update(0, buf.data(), stBytes);
+		if (runs[i].type == patchSectors &&
+			uiCrc32 == Crc32Update(0, (const BYTE*)patch.data() + runs[i].stData, runs[i].stDataSize)) {
+			runs[i].bHeld = TRUE;
+			continue;
+		}
+		if (uiCrc32 != runs[i].uiCrc32) {
+			OutputErrorString("LBA[%06d, %#07x]: isn't what the patch was made from (already applied?)\n"
+				, (INT)runs[i].dwLBA, (INT)runs[i].dwLBA);
+			return FALSE;
+		}
 	}
-	if (NULL == ((*pErrStruct).invalidModeNum = (DWORD*)calloc(stAllocSize, sizeof(DWORD)))) {
+
+	*lpSectors = 0;
+	for (size_t i = 0; i < runs.size(); i++) {
+		if (runs[i].bHeld) {
+			continue;
+		}
+		UINT64 ui64Offset = (UINT64)runs[i].dwLBA * CD_RAW_SECTOR_SIZE;
+		size_t stBytes = (size_t)runs[i].dwCount * CD_RAW_SECTOR_SIZE;
+		if (!ReadImageAt(fp, ui64Offset, buf.data(), stBytes)) {
+			OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+			return FALSE;
+		}
+		if (runs[i].type == patchFill55) {
+			for (DWORD k = 0; k < runs[i].dwCount; k++) {
+				LPBYTE lpSector = buf.data() + k * CD_RAW_SECTOR_SIZE;
+				BYTE m, s, f;
+				LBAtoMSF((INT)(runs[i].dwLBA + k) + 150, &m, &s, &f);
+				lpSector[12] = DecToBcd(m);
+				lpSector[13] = DecToBcd(s);
+				lpSector[14] = DecToBcd(f);
+				memset(lpSector + 16, 0x55, 2336);
+			}
+		}
+		else if (runs[i].type == patchSectors) {
+			memcpy(buf.data(), patch.data() + runs[i].stData, stBytes);
+		}
+		else {
+			for (size_t stSpan = runs[i].stData; stSpan < runs[i].stData + runs[i].stDataSize;) {
+				UINT64 ui64SpanOffset = 0;
+				UINT64 ui64SpanSize = 0;
+				readPatchValue(patch, &stSpan, sizeof(WORD), &ui64SpanOffset);
+				readPatchValue(patch, &stSpan, sizeof(WORD), &ui64SpanSize);
+				memcpy(buf.data() + ui64SpanOffset, patch.data() + stSpan, (size_t)ui64SpanSize);
+				stSpan += (size_t)ui64SpanSize;
+			}
+		}
+		if (!WriteImageAt(fp, ui64Offset, buf.data(), stBytes)) {
+			OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+			return FALSE;
+		}
+		*lpSectors += runs[i].dwCount;
+	}
+	if (*lpSectors && !SyncImage(fp)) {
 		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
 		return FALSE;
 	}
-	if (NULL == ((*pErrStruct).nonZeroInvalidSyncNum = (DWORD*)calloc(stAllocSize, sizeof(DWORD)))) {
-		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+	return TRUE;
+}
+
+//
+// An in-place fix writes (and syncs) the journal of what it overwrites before
+// it touches the image, then applies its patch; the journal of an earlier fix
+// is never overwritten, as unfix couldn't go back past it then
+//
+BOOL applyPatchWithJournal(
+	FILE *fp,
+	LPCSTR pszJournalPath,
+	const std::string& patch,
+	const std::string& journal
+) {
+	FILE* fpJournal = fopen(pszJournalPath, "rb");
+	if (fpJournal) {
+		fclose(fpJournal);
+		OutputErrorString("%s of an earlier fix is there, unfix or remove it first\n", pszJournalPath);
 		return FALSE;
 	}
-	if (NULL == ((*pErrStruct).zeroSyncNum = (DWORD*)calloc(stAllocSize, sizeof(DWORD)))) {
+	if (!writePatch(pszJournalPath, journal)) {
 		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+		OutputErrorString("Failed to write %s\n", pszJournalPath);
+		remove(pszJournalPath);
 		return FALSE;
 	}
-	memset((*pErrStruct).zeroSyncNum, 0xFF, stAllocSize * sizeof(DWORD));
+	DWORD dwSectors = 0;
+	return applyPatch(fp, patch, &dwSectors);
+}
 
-	if (NULL == ((*pErrStruct).zeroSyncPregapNum = (DWORD*)calloc(stAllocSize, sizeof(DWORD)))) {
-		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
-		return FALSE;
+//
+// Fixes the sectors of all the lists in one pass in LBA order: a run of
+// adjacent sectors is read, patched in memory (corrected by ecc, or the 2336
+// bytes after the header replaced at 0x55) and written back at once, and the
+// file is synced once at the end
+// With pPatch, the sectors that change are appended to it as patch records
+// instead, and the image is only read; pJournal (which needs pPatch) gets
+// them as they were, for unfix
+// FALSE when the image can't be read, written or synced, and then nothing
+// that was built is to be used
+//
+BOOL fixSectors(
+	EXEC_TYPE execType,
+	FILE *fp,
+	const std::vector<const std::vector<DWORD>*>& errorLists,
+	DWORD startLBA,
+	DWORD endLBA,
+	LPINT lpFixedCount,
+	LPINT lpCorrectedCount,
+	std::string* pPatch,
+	std::string* pJournal
+) {
+	std::vector<DWORD> sectors;
+
+	for (size_t i = 0; i < errorLists.size(); i++) {
+		for (size_t j = 0; j < errorLists[i]->size(); j++) {
+			DWORD dwLBA = (*errorLists[i])[j];
+			if (startLBA <= dwLBA && dwLBA <= endLBA) {
+				sectors.push_back(dwLBA);
+			}
+		}
+	}
+	std::sort(sectors.begin(), sectors.end());
+	sectors.erase(std::unique(sectors.begin(), sectors.end()), sectors.end());
+
+	std::vector<BYTE> run((size_t)FIX_RUN_SECTORS * CD_RAW_SECTOR_SIZE);
+	std::vector<BYTE> original(pPatch ? run.size() : 0);
+	BOOL bFilled[FIX_RUN_SECTORS] = {};
+	BOOL bChanged[FIX_RUN_SECTORS] = {};
+	for (size_t i = 0; i < sectors.size();) {
+		size_t stCount = 1;
+		while (i + stCount < sectors.size() && stCount < FIX_RUN_SECTORS &&
+			sectors[i + stCount] == sectors[i] + stCount) {
+			stCount++;
+		}
+		UINT64 ui64Offset = (UINT64)sectors[i] * CD_RAW_SECTOR_SIZE;
+#ifdef _WIN32
+		if (execType == checkex) {
+			ui64Offset = (UINT64)(sectors[i] - startLBA) * CD_RAW_SECTOR_SIZE;
+		}
+#endif
+		size_t stBytes = stCount * CD_RAW_SECTOR_SIZE;
+		if (!ReadImageAt(fp, ui64Offset, run.data(), stBytes)) {
+			OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+			return FALSE;
+		}
+		if (pPatch) {
+			memcpy(original.data(), run.data(), stBytes);
+		}
+		for (size_t k = 0; k < stCount; k++) {
+			LPBYTE lpSector = run.data() + k * CD_RAW_SECTOR_SIZE;
+
+			bFilled[k] = FALSE;
+			if (execType == correct) {
+				BYTE before[CD_RAW_SECTOR_SIZE];
+				memcpy(before, lpSector, sizeof(before));
+				if (correct_sector(lpSector)) {
+					// already intact, so there's nothing to correct (nor to replace)
+					if (memcmp(before, lpSector, sizeof(before))) {
+						(*lpCorrectedCount)++;
+					}
+					continue;
+				}
+			}
+			bFilled[k] = TRUE;
+			BYTE m, s, f;
+			LBAtoMSF((INT)sectors[i + k] + 150, &m, &s, &f);
+			lpSector[12] = DecToBcd(m);
+			lpSector[13] = DecToBcd(s);
+			lpSector[14] = DecToBcd(f);
+			memset(lpSector + 16, 0x55, 2336);
+			(*lpFixedCount)++;
+		}
+		if (pPatch) {
+			// a record for each stretch replaced at 0x55, and each sector corrected,
+			// leaving out the sectors a fix before already replaced
+			for (size_t k = 0; k < stCount; k++) {
+				bChanged[k] = memcmp(original.data() + k * CD_RAW_SECTOR_SIZE
+					, run.data() + k * CD_RAW_SECTOR_SIZE, CD_RAW_SECTOR_SIZE) != 0;
+			}
+			for (size_t k = 0; k < stCount;) {
+				size_t stSame = 1;
+				if (!bChanged[k]) {
+					k++;
+					continue;
+				}
+				while (bFilled[k] && k + stSame < stCount && bChanged[k + stSame] && bFilled[k + stSame]) {
+					stSame++;
+				}
+				appendPatchRecord(*pPatch, bFilled[k] ? patchFill55 : patchBytes, sectors[i + k], (DWORD)stSame
+					, original.data() + k * CD_RAW_SECTOR_SIZE, run.data() + k * CD_RAW_SECTOR_SIZE);
+				k += stSame;
+			}
+			for (size_t k = 0; pJournal && k < stCount;) {
+				size_t stSame = 1;
+				if (!bChanged[k]) {
+					k++;
+					continue;
+				}
+				while (k + stSame < stCount && bChanged[k + stSame]) {
+					stSame++;
+				}
+				appendPatchRecord(*pJournal, patchSectors, sectors[i + k], (DWORD)stSame
+					, run.data() + k * CD_RAW_SECTOR_SIZE, original.data() + k * CD_RAW_SECTOR_SIZE);
+				k += stSame;
+			}
+			i += stCount;
+			continue;
+		}
+		if (!WriteImageAt(fp, ui64Offset, run.data(), stBytes)) {
+			OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+			return FALSE;
+		}
+		i += stCount;
 	}
-	if (NULL == ((*pErrStruct).unknownModeNum = (DWORD*)calloc(stAllocSize, sizeof(DWORD)))) {
+	if (!pPatch && !sectors.empty() && !SyncImage(fp)) {
 		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
 		return FALSE;
 	}
 	return TRUE;
 }
 
-VOID terminateCountNum(
-	PERROR_STRUCT pErrStruct
+VOID classifySectors(
+	LPBYTE lpSectors,
+	size_t stCount,
+	PSECTOR_RESULT pResults
+) {
+	SectorType sectorTypes[CHECK_BATCH_SECTORS];
+	TrackMode trackModes[CHECK_BATCH_SECTORS];
+
+	for (size_t i = 0; i < stCount; i += CHECK_BATCH_SECTORS) {
+		size_t stBatch = stCount - i < CHECK_BATCH_SECTORS ? stCount - i : CHECK_BATCH_SECTORS;
+		LPBYTE lpBatch = lpSectors + i * CD_RAW_SECTOR_SIZE;
+
+		for (size_t m = 0; m < stBatch; m++) {
+			trackModes[m] = TrackModeUnknown;
+		}
+		detect_sectors(lpBatch, stBatch, sectorTypes, trackModes);
+
+		for (size_t m = 0; m < stBatch; m++) {
+			LPBYTE buf = lpBatch + m * CD_RAW_SECTOR_SIZE;
+			PSECTOR_RESULT pResult = &pResults[i + m];
+
+			pResult->sectorType = sectorTypes[m];
+			pResult->trackMode = trackModes[m];
+			pResult->bFilled55 = IsErrorSector(buf);
+			memcpy(pResult->msf, buf + 0x0c, sizeof(pResult->msf));
+			pResult->mode = buf[0x0f];
+			memcpy(pResult->subheader, buf + 0x10, sizeof(pResult->subheader));
+			memcpy(pResult->reserved, buf + 0x814, sizeof(pResult->reserved));
+		}
+	}
+}
+
+//
+// Threads for -j, which classify a window of sectors CHECK_SLICE_SECTORS at a
+// time while the caller goes through the results of the previous window
+//
+typedef struct _CLASSIFY_POOL {
+	std::vector<std::thread> workers;
+	std::mutex mtx;
+	std::condition_variable cvWork;
+	std::condition_variable cvDone;
+	LPBYTE lpSectors;
+	PSECTOR_RESULT pResults;
+	size_t stCount;
+	size_t stNext;
+	size_t stDone;
+	BOOL bStop;
+} CLASSIFY_POOL, *PCLASSIFY_POOL;
+
+VOID classifyWorker(
+	PCLASSIFY_POOL pPool
+) {
+	std::unique_lock<std::mutex> lock(pPool->mtx);
+
+	for (;;) {
+		pPool->cvWork.wait(lock, [pPool] { return pPool->bStop || pPool->stNext < pPool->stCount; });
+		if (pPool->bStop) {
+			return;
+		}
+		size_t stFirst = pPool->stNext;
+		size_t stSlice = pPool->stCount - stFirst < CHECK_SLICE_SECTORS ? pPool->stCount - stFirst : CHECK_SLICE_SECTORS;
+		pPool->stNext += stSlice;
+		LPBYTE lpSectors = pPool->lpSectors + stFirst * CD_RAW_SECTOR_SIZE;
+		PSECTOR_RESULT pResults = pPool->pResults + stFirst;
+
+		lock.unlock();
+		classifySectors(lpSectors, stSlice, pResults);
+		lock.lock();
+
+		pPool->stDone += stSlice;
+		if (pPool->stDone == pPool->stCount) {
+			pPool->cvDone.notify_one();
+		}
+	}
+}
+
+VOID startClassifyPool(
+	PCLASSIFY_POOL pPool,
+	UINT uiThreads
 ) {
-	FreeAndNull((*pErrStruct).badMsfNum);
-	FreeAndNull((*pErrStruct).notAllZeroNum);
-	FreeAndNull((*pErrStruct).errorNum);
-	FreeAndNull((*pErrStruct).noMatchLBANum);
-	FreeAndNull((*pErrStruct).reservedNum);
-	FreeAndNull((*pErrStruct).noEDCNum);
-	FreeAndNull((*pErrStruct).mode2Form1Num);
-	FreeAndNull((*pErrStruct).mode2Form2Num);
-	FreeAndNull((*pErrStruct).mode2Num);
-	FreeAndNull((*pErrStruct).invalidModeNum);
-	FreeAndNull((*pErrStruct).nonZeroInvalidSyncNum);
-	FreeAndNull((*pErrStruct).zeroSyncNum);
-	FreeAndNull((*pErrStruct).zeroSyncPregapNum);
-	FreeAndNull((*pErrStruct).unknownModeNum);
+	pPool->lpSectors = NULL;
+	pPool->pResults = NULL;
+	pPool->stCount = pPool->stNext = pPool->stDone = 0;
+	pPool->bStop = FALSE;
+	for (UINT i = 0; i < uiThreads; i++) {
+		pPool->workers.push_back(std::thread(classifyWorker, pPool));
+	}
 }
 
-INT handleCheckDetail(
+// The sectors must stay readable until waitClassifyPool returns
+VOID submitClassifyPool(
+	PCLASSIFY_POOL pPool,
+	LPBYTE lpSectors,
+	size_t stCount,
+	PSECTOR_RESULT pResults
+) {
+	{
+		std::lock_guard<std::mutex> lock(pPool->mtx);
+		pPool->lpSectors = lpSectors;
+		pPool->pResults = pResults;
+		pPool->stCount = stCount;
+		pPool->stNext = pPool->stDone = 0;
+	}
+	pPool->cvWork.notify_all();
+}
+
+VOID waitClassifyPool(
+	PCLASSIFY_POOL pPool
+) {
+	std::unique_lock<std::mutex> lock(pPool->mtx);
+	pPool->cvDone.wait(lock, [pPool] { return pPool->stDone == pPool->stCount; });
+}
+
+VOID stopClassifyPool(
+	PCLASSIFY_POOL pPool
+) {
+	if (pPool->workers.empty()) {
+		return;
+	}
+	waitClassifyPool(pPool);
+	{
+		std::lock_guard<std::mutex> lock(pPool->mtx);
+		pPool->bStop = TRUE;
+	}
+	pPool->cvWork.notify_all();
+	for (auto& worker : pPool->workers) {
+		worker.join();
+	}
+	pPool->workers.clear();
+}
+
+// The log thread waits for the next window without a lock; it's never the
+// one that is waited for
+PCHECK_WINDOW popCheckWindow(
+	SpscQueue<PCHECK_WINDOW>& queue
+) {
+	PCHECK_WINDOW pWindow = NULL;
+
+	for (UINT uiTry = 0; !queue.pop(pWindow); uiTry++) {
+		if (uiTry < 64) {
+			std::this_thread::yield();
+		}
+		else {
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+	}
+	return pWindow;
+}
+
+// Only waits when the image size wasn't known, and the queue is as long as
+// the log is allowed to lag behind
+VOID pushCheckWindow(
+	SpscQueue<PCHECK_WINDOW>& queue,
+	PCHECK_WINDOW pWindow
+) {
+	while (!queue.push(pWindow)) {
+		std::this_thread::yield();
+	}
+}
+
+//
+// Adds the sector to the lists of the summary, and returns whether it went in
+// any of them
+//
+BOOL recordCheckDetail(
 	PERROR_STRUCT pErrStruct,
-	EXEC_TYPE execType,
-	LPBYTE buf,
+	PSECTOR_RESULT pResult,
 	BOOL skipTrackModeCheck,
 	TrackMode trackMode,
 	UINT roopCnt,
-	UINT roopCnt2,
-	BOOL bSub,
-	LPBYTE subBuf
+	BOOL bSub
 ) {
-#ifndef _WIN32
-	UNREFERENCED_PARAMETER(execType);
-	UNREFERENCED_PARAMETER(roopCnt2);
-#endif
-	if (IsErrorSector(buf)) {
-		OutputFileWithLbaMsf("2336 bytes have been already replaced at 0x55\n", roopCnt, roopCnt, buf[12], buf[13], buf[14]);
-		pErrStruct->errorNum[pErrStruct->cnt_SectorFilled55++] = roopCnt;
+	SectorType sectorType = pResult->sectorType;
+	TrackMode trackModeLocal = pResult->trackMode;
+
+	if (pResult->bFilled55) {
+		pErrStruct->errorNum.push_back(roopCnt);
+		pErrStruct->cnt_SectorFilled55++;
 		return TRUE;
 	}
 
-	TrackMode trackModeLocal = TrackModeUnknown;
-	SectorType sectorType = detect_sector(buf, CD_RAW_SECTOR_SIZE, &trackModeLocal);
+	if (trackMode == TrackModeUnknown && trackModeLocal != TrackModeUnknown) {
+		trackMode = trackModeLocal;
+		skipTrackModeCheck = FALSE;
+	}
+
+	switch (sectorType) {
+	case Mode0:
+	case Mode0WithBlockIndicators:
+	case Mode1:
+	case Mode1WithBlockIndicators:
+	case Mode2Form1:
+	case Mode2Form2:
+	case Mode2WithBlockIndicators:
+		return FALSE;
+	case InvalidMode0:
+	case InvalidMode1:
+	case InvalidMode2Form1:
+	case InvalidMode2Form2:
+	case InvalidMode2:
+		pErrStruct->invalidModeNum.push_back(roopCnt);
+		pErrStruct->cnt_InvalidMode++;
+		break;
+	case Mode0NotAllZero:
+		pErrStruct->notAllZeroNum.push_back(roopCnt);
+		pErrStruct->cnt_Mode0NotAllZero++;
+		break;
+	case Mode1BadEcc:
+		pErrStruct->noMatchLBANum.push_back(roopCnt);
+		pErrStruct->cnt_Mode1BadEcc++;
+		break;
+	case Mode1ReservedNotZero:
+		if (pResult->reserved[0] == 0x55 && pResult->reserved[1] == 0x55 && pResult->reserved[2] == 0x55 && pResult->reserved[3] == 0x55 &&
+			pResult->reserved[4] == 0x55 && pResult->reserved[5] == 0x55 && pResult->reserved[6] == 0x55 && pResult->reserved[7] == 0x55) {
+			pErrStruct->noMatchLBANum.push_back(roopCnt);
+			pErrStruct->cnt_Mode1BadEcc++;
+		}
+		else {
+			pErrStruct->reservedNum.push_back(roopCnt);
+			pErrStruct->cnt_Mode1ReservedNotZero++;
+		}
+		break;
+	case Mode2Form1SubheaderNotSame:
+		pErrStruct->mode2Form1Num.push_back(roopCnt);
+		pErrStruct->cnt_Mode2Form1SubheaderNotSame++;
+		break;
+	case Mode2Form2SubheaderNotSame:
+		pErrStruct->mode2Form2Num.push_back(roopCnt);
+		pErrStruct->cnt_Mode2Form2SubheaderNotSame++;
+		break;
+	case Mode2SubheaderNotSame:
+		pErrStruct->mode2Num.push_back(roopCnt);
+		pErrStruct->cnt_Mode2SubheaderNotSame++;
+		break;
+	case Mode2:
+		if (pResult->subheader[2] & 0x20) {
+			pErrStruct->noEDCNum.push_back(roopCnt);
+			pErrStruct->cnt_Mode2++;
+		}
+		else {
+			pErrStruct->noMatchLBANum.push_back(roopCnt);
+			pErrStruct->cnt_Mode1BadEcc++;
+		}
+		break;
+	case UnknownMode:
+		pErrStruct->unknownModeNum.push_back(roopCnt);
+		pErrStruct->cnt_UnknownMode++;
+		break;
+	default:
+		// the rest is checked against the track mode first
+		if (!skipTrackModeCheck && trackMode != trackModeLocal) {
+			pErrStruct->unknownModeNum.push_back(roopCnt);
+			pErrStruct->cnt_UnknownMode++;
+		}
+		else if (sectorType == NonZeroInvalidSync) {
+			pErrStruct->nonZeroInvalidSyncNum.push_back(roopCnt);
+			pErrStruct->cnt_NonZeroInvalidSync++;
+		}
+		else if (sectorType == ZeroSync) {
+			BYTE byCtl = (BYTE)((pResult->subQ[0] >> 4) & 0x0f);
+			BYTE byIdx = pResult->subQ[2];
+
+			if (bSub && (byCtl == 0 || byCtl == 2) && byIdx == 0) {
+				pErrStruct->zeroSyncPregapNum.push_back(roopCnt);
+				pErrStruct->cnt_ZeroSyncPregap++;
+			}
+			else {
+				pErrStruct->zeroSyncNum.push_back(roopCnt);
+				pErrStruct->cnt_ZeroSync++;
+			}
+		}
+		else {
+			return FALSE;
+		}
+		break;
+	}
+	return TRUE;
+}
+
+VOID outputCheckDetail(
+	PSECTOR_RESULT pResult,
+	BOOL skipTrackModeCheck,
+	TrackMode trackMode,
+	UINT roopCnt,
+	BOOL bSub
+) {
+	SectorType sectorType = pResult->sectorType;
+	TrackMode trackModeLocal = pResult->trackMode;
+
+	if (pResult->bFilled55) {
+		OutputFileWithLbaMsf("2336 bytes have been already replaced at 0x55\n", roopCnt, roopCnt, pResult->msf[0], pResult->msf[1], pResult->msf[2]);
+		return;
+	}
 
 	if (trackMode == TrackModeUnknown && trackModeLocal != TrackModeUnknown) {
 		trackMode = trackModeLocal;
 		skipTrackModeCheck = FALSE;
 	}
 
-	BYTE byCtl = (BYTE)((subBuf[12] >> 4) & 0x0f);
-	BYTE byIdx = subBuf[14];
+	BYTE byCtl = (BYTE)((pResult->subQ[0] >> 4) & 0x0f);
+	BYTE byIdx = pResult->subQ[2];
 
 	if (sectorType == Mode0 || sectorType == InvalidMode0 ||
 		sectorType == Mode0NotAllZero || sectorType == Mode0WithBlockIndicators) {
-		OutputFileWithLbaMsf("mode 0", roopCnt, roopCnt, buf[12], buf[13], buf[14]);
+		OutputFileWithLbaMsf("mode 0", roopCnt, roopCnt, pResult->msf[0], pResult->msf[1], pResult->msf[2]);
 		if (sectorType == Mode0) {
 			OutputFile("\n");
 		}
@@ -378,17 +1243,15 @@ INT handleCheckDetail(
 			OutputFile(" with Block Indicators\n");
 		}
 		else if (sectorType == InvalidMode0) {
-			OutputFile(" Invalid mode: [%02x]\n", buf[15]);
-			pErrStruct->invalidModeNum[pErrStruct->cnt_InvalidMode++] = roopCnt;
+			OutputFile(" Invalid mode: [%02x]\n", pResult->mode);
 		}
 		else {
 			OutputFile(" Not all user data zero\n");
-			pErrStruct->notAllZeroNum[pErrStruct->cnt_Mode0NotAllZero++] = roopCnt;
 		}
 	}
 	else if (sectorType == Mode1 || sectorType == Mode1WithBlockIndicators ||
 		sectorType == InvalidMode1 || sectorType == Mode1BadEcc || sectorType == Mode1ReservedNotZero) {
-		OutputFileWithLbaMsf("mode 1", roopCnt, roopCnt, buf[12], buf[13], buf[14]);
+		OutputFileWithLbaMsf("mode 1", roopCnt, roopCnt, pResult->msf[0], pResult->msf[1], pResult->msf[2]);
 		if (sectorType == Mode1) {
 			OutputFile("\n");
 		}
@@ -396,30 +1259,26 @@ INT handleCheckDetail(
 			OutputFile(" with Block Indicators\n");
 		}
 		else if (sectorType == InvalidMode1) {
-			OutputFile(" Invalid mode: [%02x]\n", buf[15]);
-			pErrStruct->invalidModeNum[pErrStruct->cnt_InvalidMode++] = roopCnt;
+			OutputFile(" Invalid mode: [%02x]\n", pResult->mode);
 		}
 		else if (sectorType == Mode1BadEcc) {
 			OutputFile(" User data vs. ecc/edc doesn't match\n");
 
-			pErrStruct->noMatchLBANum[pErrStruct->cnt_Mode1BadEcc++] = roopCnt;
 		}
 		else if (sectorType == Mode1ReservedNotZero) {
-			if (buf[0x814] == 0x55 && buf[0x815] == 0x55 && buf[0x816] == 0x55 && buf[0x817] == 0x55 &&
-				buf[0x818] == 0x55 && buf[0x819] == 0x55 && buf[0x81a] == 0x55 && buf[0x81b] == 0x55) {
+			if (pResult->reserved[0] == 0x55 && pResult->reserved[1] == 0x55 && pResult->reserved[2] == 0x55 && pResult->reserved[3] == 0x55 &&
+				pResult->reserved[4] == 0x55 && pResult->reserved[5] == 0x55 && pResult->reserved[6] == 0x55 && pResult->reserved[7] == 0x55) {
 				OutputFile(" This sector have been already replaced at 0x55 but it's incompletely\n");
 
-				pErrStruct->noMatchLBANum[pErrStruct->cnt_Mode1BadEcc++] = roopCnt;
 			}
 			else {
 				OutputFile(
 					" Reserved doesn't zero."
 					" [0x814]:%#04x, [0x815]:%#04x, [0x816]:%#04x, [0x817]:%#04x,"
 					" [0x818]:%#04x, [0x819]:%#04x, [0x81a]:%#04x, [0x81b]:%#04x\n"
-					, buf[0x814], buf[0x815], buf[0x816], buf[0x817]
-					, buf[0x818], buf[0x819], buf[0x81a], buf[0x81b]);
+					, pResult->reserved[0], pResult->reserved[1], pResult->reserved[2], pResult->reserved[3]
+					, pResult->reserved[4], pResult->reserved[5], pResult->reserved[6], pResult->reserved[7]);
 
-				pErrStruct->reservedNum[pErrStruct->cnt_Mode1ReservedNotZero++] = roopCnt;
 			}
 		}
 	}
@@ -428,9 +1287,7 @@ INT handleCheckDetail(
 		sectorType == Mode2 || sectorType == InvalidMode2 ||
 		sectorType == Mode2Form1SubheaderNotSame ||	sectorType == Mode2Form2SubheaderNotSame ||
 		sectorType == Mode2SubheaderNotSame || sectorType == Mode2WithBlockIndicators) {
-		BOOL bNoEdc = FALSE;
-
-		OutputFileWithLbaMsf("mode 2", roopCnt, roopCnt, buf[12], buf[13], buf[14]);
+		OutputFileWithLbaMsf("mode 2", roopCnt, roopCnt, pResult->msf[0], pResult->msf[1], pResult->msf[2]);
 		if (sectorType == Mode2Form1) {
 			OutputFile(" form 1, ");
 		}
@@ -438,118 +1295,105 @@ INT handleCheckDetail(
 			OutputFile(" with Block Indicators ");
 		}
 		else if (sectorType == InvalidMode2Form1) {
-			OutputFile(" Invalid mode 2 form 1: [%02x] ", buf[15]);
-			pErrStruct->invalidModeNum[pErrStruct->cnt_InvalidMode++] = roopCnt;
+			OutputFile(" Invalid mode 2 form 1: [%02x] ", pResult->mode);
 		}
 		else if (sectorType == Mode2Form2) {
 			OutputFile(" form 2, ");
 		}
 		else if (sectorType == InvalidMode2Form2) {
-			OutputFile(" Invalid mode 2 form 2: [%02x] ", buf[15]);
-			pErrStruct->invalidModeNum[pErrStruct->cnt_InvalidMode++] = roopCnt;
+			OutputFile(" Invalid mode 2 form 2: [%02x] ", pResult->mode);
 		}
 		else if (sectorType == Mode2) {
 			OutputFile(" no edc, ");
-			bNoEdc = TRUE;
 		}
 		else if (sectorType == InvalidMode2) {
-			OutputFile(" Invalid mode 2: [%02x] ", buf[15]);
-			pErrStruct->invalidModeNum[pErrStruct->cnt_InvalidMode++] = roopCnt;
+			OutputFile(" Invalid mode 2: [%02x] ", pResult->mode);
 		}
 		else if (sectorType == Mode2Form1SubheaderNotSame ||
 			sectorType == Mode2Form2SubheaderNotSame ||
 			sectorType == Mode2SubheaderNotSame) {
 			if (sectorType == Mode2Form1SubheaderNotSame) {
 				OutputFile(" form 1, ");
-				pErrStruct->mode2Form1Num[pErrStruct->cnt_Mode2Form1SubheaderNotSame++] = roopCnt;
 			}
 			else if (sectorType == Mode2Form2SubheaderNotSame) {
 				OutputFile(" form 2, ");
-				pErrStruct->mode2Form2Num[pErrStruct->cnt_Mode2Form2SubheaderNotSame++] = roopCnt;
 			}
 			else if (sectorType == Mode2SubheaderNotSame) {
 				OutputFile(" no edc, ");
-				pErrStruct->mode2Num[pErrStruct->cnt_Mode2SubheaderNotSame++] = roopCnt;
 			}
 			OutputFile("Subheader isn't same."
 				" [0x10]:%#04x, [0x11]:%#04x, [0x12]:%#04x, [0x13]:%#04x,"
 				" [0x14]:%#04x, [0x15]:%#04x, [0x16]:%#04x, [0x17]:%#04x, "
-				, buf[0x10], buf[0x11], buf[0x12], buf[0x13], buf[0x14], buf[0x15], buf[0x16], buf[0x17]);
+				, pResult->subheader[0], pResult->subheader[1], pResult->subheader[2], pResult->subheader[3], pResult->subheader[4], pResult->subheader[5], pResult->subheader[6], pResult->subheader[7]);
 		}
 
-		OutputFile("SubHeader[1](FileNum[%02x]), [2](ChannelNum[%02x]), [3](Submode[%02x])[", buf[16], buf[17], buf[18]);
-		if (buf[18] & 0x80) {
+		OutputFile("SubHeader[1](FileNum[%02x]), [2](ChannelNum[%02x]), [3](Submode[%02x])[", pResult->subheader[0], pResult->subheader[1], pResult->subheader[2]);
+		if (pResult->subheader[2] & 0x80) {
 			OutputFile("EOF");
 		}
 		else {
 			OutputFile("NoEOF");
 		}
 
-		if (buf[18] & 0x40) {
+		if (pResult->subheader[2] & 0x40) {
 			OutputFile(", Real-time");
 		}
 
-		if (buf[18] & 0x20) {
+		if (pResult->subheader[2] & 0x20) {
 			OutputFile(", Form 2");
-			if (bNoEdc) {
-				pErrStruct->noEDCNum[pErrStruct->cnt_Mode2++] = roopCnt;
-			}
 		}
 		else {
 			OutputFile(", Form 1");
-			if (bNoEdc) {
-				pErrStruct->noMatchLBANum[pErrStruct->cnt_Mode1BadEcc++] = roopCnt;
-			}
 		}
 
-		if (buf[18] & 0x10) {
+		if (pResult->subheader[2] & 0x10) {
 			OutputFile(", Trigger");
 		}
 
 		BOOL bAudio = FALSE;
 		BOOL bVideo = FALSE;
 
-		if (buf[18] & 0x08) {
+		if (pResult->subheader[2] & 0x08) {
 			OutputFile(", Data");
 		}
-		else if (buf[18] & 0x04) {
+		else if (pResult->subheader[2] & 0x04) {
 			OutputFile(", Audio");
 			bAudio = TRUE;
 		}
-		else if (buf[18] & 0x02) {
+		else if (pResult->subheader[2] & 0x02) {
 			OutputFile(", Video");
 			bVideo = TRUE;
 		}
 
-		if (buf[18] & 0x01) {
+		if (pResult->subheader[2] & 0x01) {
 			OutputFile(", EndOfRecord");
 		}
 
-		OutputFile("], [4](CodingInfo[%02x])[", buf[19]);
+		OutputFile("], [4](CodingInfo[%02x])[", pResult->subheader[3]);
 
 		if (bAudio) {
-			if (buf[19] & 0x40) {
+			if (pResult->subheader[3] & 0x40) {
 				OutputFile("Emphasis On");
 			}
 			else {
 				OutputFile("Emphasis Off");
 			}
 
-			if (buf[19] & 0x10) {
+			if (pResult->subheader[3] & 0x10) {
 				OutputFile(", 8 bits/sample");
 			}
 			else {
 				OutputFile(", 4 bits/sample");
 			}
 
-			if (buf[19] & 0x04) {
+			if (pResult->subheader[3] & 0x04) {
 				OutputFile(", 18.9kHz");
 			}
 			else {
 				OutputFile(", 37.8kHz");
 			}
 
-			if (buf[19] & 0x01) {
+			if (pResult->subheader[3] & 0x01) {
 				OutputFile(", Stereo");
 			}
 			else {
@@ -557,105 +1401,437 @@ INT handleCheckDetail(
 			}
 		}
 		else if (bVideo) {
-			if (buf[19] & 0x80) {
+			if (pResult->subheader[3] & 0x80) {
 				OutputFile("Application-specific coding");
 			}
 			else {
 				OutputFile("chapter V coding");
 			}
 			
-			if (buf[19] & 0x40) {
+			if (pResult->subheader[3] & 0x40) {
 				OutputFile(", Even lines");
 			}
 			else {
 				OutputFile(", Odd lines");
 			}
 
-			if (buf[19] & 0x30) {
+			if (pResult->subheader[3] & 0x30) {
 				OutputFile(", High Resolution");
 			}
-			else if (buf[19] & 0x10) {
+			else if (pResult->subheader[3] & 0x10) {
 				OutputFile(", Double Resolution");
 			}
 			else {
 				OutputFile(", Normal Resolution");
 			}
 
-			if (buf[19] & 0x07) {
+			if (pResult->subheader[3] & 0x07) {
 				OutputFile(", RGB555 (upper)");
 			}
-			else if (buf[19] & 0x06) {
+			else if (pResult->subheader[3] & 0x06) {
 				OutputFile(", RGB555 (lower)");
 			}
-			else if (buf[19] & 0x05) {
+			else if (pResult->subheader[3] & 0x05) {
 				OutputFile(", DYUV");
 			}
-			else if (buf[19] & 0x04) {
+			else if (pResult->subheader[3] & 0x04) {
 				OutputFile(", RL7");
 			}
-			else if (buf[19] & 0x03) {
+			else if (pResult->subheader[3] & 0x03) {
 				OutputFile(", RL3");
 			}
-			else if (buf[19] & 0x02) {
+			else if (pResult->subheader[3] & 0x02) {
 				OutputFile(", CLUT8");
 			}
-			else if (buf[19] & 0x01) {
+			else if (pResult->subheader[3] & 0x01) {
 				OutputFile(", CLUT7");
 			}
-			else if ((buf[19] & 0x0f) == 0) {
+			else if ((pResult->subheader[3] & 0x0f) == 0) {
 				OutputFile(", CLUT4");
 			}
 		}
 		OutputFile("]\n");
 	}
 	else if (sectorType == UnknownMode) {
-		OutputFileWithLbaMsf("unknown mode: %02x\n", roopCnt, roopCnt, buf[12], buf[13], buf[14], buf[15]);
-		pErrStruct->unknownModeNum[pErrStruct->cnt_UnknownMode++] = roopCnt;
+		OutputFileWithLbaMsf("unknown mode: %02x\n", roopCnt, roopCnt, pResult->msf[0], pResult->msf[1], pResult->msf[2], pResult->mode);
 	}
 	else if (!skipTrackModeCheck && trackMode != trackModeLocal) {
-		OutputFileWithLbaMsf("changed track mode: %d %d\n", roopCnt, roopCnt, buf[12], buf[13], buf[14], trackMode, trackModeLocal);
-		pErrStruct->unknownModeNum[pErrStruct->cnt_UnknownMode++] = roopCnt;
+		OutputFileWithLbaMsf("changed track mode: %d %d\n", roopCnt, roopCnt, pResult->msf[0], pResult->msf[1], pResult->msf[2], trackMode, trackModeLocal);
 	}
 	else if (sectorType == NonZeroInvalidSync) {
 		if (bSub) {
-			OutputFileWithLbaMsf("invalid sync\n", roopCnt, roopCnt, buf[12], buf[13], buf[14]);
+			OutputFileWithLbaMsf("invalid sync\n", roopCnt, roopCnt, pResult->msf[0], pResult->msf[1], pResult->msf[2]);
 		}
 		else {
-			OutputFileWithLbaMsf("audio or invalid sync\n", roopCnt, roopCnt, buf[12], buf[13], buf[14]);
+			OutputFileWithLbaMsf("audio or invalid sync\n", roopCnt, roopCnt, pResult->msf[0], pResult->msf[1], pResult->msf[2]);
 		}
-		pErrStruct->nonZeroInvalidSyncNum[pErrStruct->cnt_NonZeroInvalidSync++] = roopCnt;
 	}
 	else if (sectorType == ZeroSync) {
 		if (bSub) {
 			if ((byCtl == 0 || byCtl == 2) && byIdx == 0) {
-				OutputFileWithLbaMsf("zero sync (pregap)\n", roopCnt, roopCnt, buf[12], buf[13], buf[14]);
+				OutputFileWithLbaMsf("zero sync (pregap)\n", roopCnt, roopCnt, pResult->msf[0], pResult->msf[1], pResult->msf[2]);
 			}
 			else {
-				OutputFileWithLbaMsf("zero sync\n", roopCnt, roopCnt, buf[12], buf[13], buf[14]);
+				OutputFileWithLbaMsf("zero sync\n", roopCnt, roopCnt, pResult->msf[0], pResult->msf[1], pResult->msf[2]);
 			}
 		}
 		else {
-			OutputFileWithLbaMsf("audio or zero sync\n", roopCnt, roopCnt, buf[12], buf[13], buf[14]);
+			OutputFileWithLbaMsf("audio or zero sync\n", roopCnt, roopCnt, pResult->msf[0], pResult->msf[1], pResult->msf[2]);
 		}
-#ifdef _WIN32
-		if (execType == checkex) {
-			pErrStruct->zeroSyncNum[roopCnt2] = roopCnt;
+	}
+}
+
+INT handleCheckDetail(
+	PERROR_STRUCT pErrStruct,
+	PSECTOR_RESULT pResult,
+	BOOL skipTrackModeCheck,
+	TrackMode trackMode,
+	UINT roopCnt,
+	BOOL bSub
+) {
+	BOOL bListed = recordCheckDetail(pErrStruct, pResult, skipTrackModeCheck, trackMode, roopCnt, bSub);
+
+	if (check_fix_mode_s_LogLevel == logLevelFull ||
+		(check_fix_mode_s_LogLevel == logLevelErrors && bListed)) {
+		outputCheckDetail(pResult, skipTrackModeCheck, trackMode, roopCnt, bSub);
+	}
+	return TRUE;
+}
+
+//
+// --report: the results of check in one file for other programs, written
+// with a single fwrite
+//
+typedef struct _TRACK_MODE_CHANGE {
+	UINT uiSector;
+	TrackMode trackMode;
+} TRACK_MODE_CHANGE, *PTRACK_MODE_CHANGE;
+
+typedef struct _REPORT_CATEGORY {
+	LPCSTR pszName;
+	LPCSTR pszLevel;
+	INT nCount;
+	const std::vector<DWORD>* pSectors;
+} REPORT_CATEGORY, *PREPORT_CATEGORY;
+
+LPCSTR trackModeName(
+	TrackMode trackMode
+) {
+	switch (trackMode) {
+	case TrackModeAudio:
+		return "audio";
+	case TrackMode0:
+		return "mode0";
+	case TrackMode1:
+		return "mode1";
+	case TrackMode2:
+		return "mode2";
+	default:
+		return "unknown";
+	}
+}
+
+VOID appendReport(
+	std::string& report,
+	LPCSTR format,
+	...
+) {
+	CHAR buf[256];
+	va_list args;
+	va_start(args, format);
+	INT nLen = vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+	if (nLen > 0) {
+		report.append(buf, (size_t)nLen < sizeof(buf) ? (size_t)nLen : sizeof(buf) - 1);
+	}
+}
+
+// JSON string with its quotes
+VOID appendReportString(
+	std::string& report,
+	LPCSTR psz
+) {
+	report += '"';
+	for (; *psz; psz++) {
+		if (*psz == '"' || *psz == '\\') {
+			report += '\\';
+			report += *psz;
+		}
+		else if ((UCHAR)*psz < 0x20) {
+			appendReport(report, "\\u%04x", (UCHAR)*psz);
 		}
 		else {
-#endif
-			if (bSub && (byCtl == 0 || byCtl == 2) && byIdx == 0) {
-				pErrStruct->zeroSyncPregapNum[pErrStruct->cnt_ZeroSyncPregap++] = roopCnt;
+			report += *psz;
+		}
+	}
+	report += '"';
+}
+
+// Sectors that follow each other in the list make one [start, end] run
+template <typename Func>
+VOID forEachSectorRange(
+	const std::vector<DWORD>& sectors,
+	Func func
+) {
+	for (size_t i = 0; i < sectors.size();) {
+		size_t j = i + 1;
+		while (j < sectors.size() && sectors[j] == sectors[j - 1] + 1) {
+			j++;
+		}
+		func(sectors[i], sectors[j - 1]);
+		i = j;
+	}
+}
+
+VOID appendReportCsvString(
+	std::string& report,
+	LPCSTR psz
+) {
+	report += '"';
+	for (; *psz; psz++) {
+		if (*psz == '"') {
+			report += '"';
+		}
+		report += *psz;
+	}
+	report += '"';
+}
+
+BOOL writeReport(
+	LPCSTR reportPath,
+	LPCSTR filePath,
+	PERROR_STRUCT pErrStruct,
+	UINT uiSectors,
+	double dSeconds,
+	BOOL bSecuROM,
+	UINT nSecuROMSector,
+	const std::vector<TRACK_MODE_CHANGE>& trackModeChanges,
+	PHASH_DIGESTS pDigests
+) {
+	const REPORT_CATEGORY categories[] = {
+		{ "badMsf", "error", pErrStruct->cnt_BadMsf, &pErrStruct->badMsfNum },
+		{ "filled55", "error", pErrStruct->cnt_SectorFilled55, &pErrStruct->errorNum },
+		{ "mode0NotAllZero", "error", pErrStruct->cnt_Mode0NotAllZero, &pErrStruct->notAllZeroNum },
+		{ "eccEdcNotMatch", "error", pErrStruct->cnt_Mode1BadEcc, &pErrStruct->noMatchLBANum },
+		{ "reservedNotZero", "warning", pErrStruct->cnt_Mode1ReservedNotZero, &pErrStruct->reservedNum },
+		{ "noEdc", "info", pErrStruct->cnt_Mode2, &pErrStruct->noEDCNum },
+		{ "mode2Form1SubheaderNotSame", "warning", pErrStruct->cnt_Mode2Form1SubheaderNotSame, &pErrStruct->mode2Form1Num },
+		{ "mode2Form2SubheaderNotSame", "warning", pErrStruct->cnt_Mode2Form2SubheaderNotSame, &pErrStruct->mode2Form2Num },
+		{ "mode2NoEdcSubheaderNotSame", "error", pErrStruct->cnt_Mode2SubheaderNotSame, &pErrStruct->mode2Num },
+		{ "invalidMode", "error", pErrStruct->cnt_InvalidMode, &pErrStruct->invalidModeNum },
+		{ "unknownMode", "error", pErrStruct->cnt_UnknownMode, &pErrStruct->unknownModeNum },
+		{ "invalidSync", "error", pErrStruct->cnt_NonZeroInvalidSync, &pErrStruct->nonZeroInvalidSyncNum },
+		{ "zeroSync", "error", pErrStruct->cnt_ZeroSync, &pErrStruct->zeroSyncNum },
+		{ "zeroSyncPregap", "info", pErrStruct->cnt_ZeroSyncPregap, &pErrStruct->zeroSyncPregapNum },
+	};
+	double dMBPerSec = dSeconds > 0 ? uiSectors * (double)CD_RAW_SECTOR_SIZE / 1000000 / dSeconds : 0;
+	std::string report;
+	CHAR szMd5[33] = {};
+	CHAR szSha1[41] = {};
+	CHAR szSha256[65] = {};
+
+	if (pDigests) {
+		DigestToString(pDigests->md5, sizeof(pDigests->md5), szMd5);
+		DigestToString(pDigests->sha1, sizeof(pDigests->sha1), szSha1);
+		if (pDigests->bSha256) {
+			DigestToString(pDigests->sha256, sizeof(pDigests->sha256), szSha256);
+		}
+	}
+
+	if (check_fix_mode_s_Report == reportJson) {
+		report += "{\n\t\"file\": ";
+		appendReportString(report, filePath);
+		appendReport(report, ",\n\t\"sectors\": %u,\n\t\"seconds\": %.3f,\n\t\"mbPerSecond\": %.2f,\n"
+			, uiSectors, dSeconds, dMBPerSec);
+		if (bSecuROM) {
+			appendReport(report, "\t\"securomSector\": %u,\n", nSecuROMSector);
+		}
+		else {
+			report += "\t\"securomSector\": null,\n";
+		}
+		if (pDigests) {
+			appendReport(report, "\t\"size\": %llu,\n\t\"crc32\": \"%08x\",\n\t\"md5\": \"%s\",\n\t\"sha1\": \"%s\",\n"
+				, (unsigned long long)pDigests->ui64Size, pDigests->uiCrc32, szMd5, szSha1);
+			if (pDigests->bSha256) {
+				appendReport(report, "\t\"sha256\": \"%s\",\n", szSha256);
 			}
-			else {
-				pErrStruct->zeroSyncNum[pErrStruct->cnt_ZeroSync++] = roopCnt;
+		}
+		if (check_fix_mode_s_pDat && check_fix_mode_s_pDatRom) {
+			report += "\t\"dat\": { \"game\": ";
+			appendReportString(report, check_fix_mode_s_pDatRom->game.c_str());
+			report += ", \"rom\": ";
+			appendReportString(report, check_fix_mode_s_pDatRom->name.c_str());
+			report += " },\n";
+		}
+		else if (check_fix_mode_s_pDat) {
+			report += "\t\"dat\": null,\n";
+		}
+		report += "\t\"categories\": {";
+		for (size_t i = 0; i < sizeof(categories) / sizeof(categories[0]); i++) {
+			appendReport(report, "%s\n\t\t\"%s\": { \"level\": \"%s\", \"count\": %d, \"ranges\": ["
+				, i ? "," : "", categories[i].pszName, categories[i].pszLevel, categories[i].nCount);
+			BOOL bFirst = TRUE;
+			forEachSectorRange(*categories[i].pSectors, [&](DWORD dwStart, DWORD dwEnd) {
+				appendReport(report, "%s[%lu, %lu]", bFirst ? "" : ", ", (ULONG)dwStart, (ULONG)dwEnd);
+				bFirst = FALSE;
+			});
+			report += "] }";
+		}
+		report += "\n\t},\n\t\"trackModeChanges\": [";
+		for (size_t i = 0; i < trackModeChanges.size(); i++) {
+			appendReport(report, "%s\n\t\t{ \"sector\": %u, \"mode\": \"%s\" }"
+				, i ? "," : "", trackModeChanges[i].uiSector, trackModeName(trackModeChanges[i].trackMode));
+		}
+		report += trackModeChanges.empty() ? "]\n}\n" : "\n\t]\n}\n";
+	}
+	else {
+		// section is summary, the level of a category with its count, range or
+		// trackMode
+		report += "section,name,value,start,end\n";
+		report += "summary,file,";
+		appendReportCsvString(report, filePath);
+		report += ",,\n";
+		appendReport(report, "summary,sectors,%u,,\nsummary,seconds,%.3f,,\nsummary,mbPerSecond,%.2f,,\n"
+			, uiSectors, dSeconds, dMBPerSec);
+		if (bSecuROM) {
+			appendReport(report, "summary,securomSector,%u,,\n", nSecuROMSector);
+		}
+		if (pDigests) {
+			appendReport(report, "summary,size,%llu,,\nsummary,crc32,%08x,,\nsummary,md5,%s,,\nsummary,sha1,%s,,\n"
+				, (unsigned long long)pDigests->ui64Size, pDigests->uiCrc32, szMd5, szSha1);
+			if (pDigests->bSha256) {
+				appendReport(report, "summary,sha256,%s,,\n", szSha256);
 			}
-#ifdef _WIN32
 		}
-#endif
+		if (check_fix_mode_s_pDat) {
+			report += "summary,datGame,";
+			appendReportCsvString(report, check_fix_mode_s_pDatRom ? check_fix_mode_s_pDatRom->game.c_str() : "");
+			report += ",,\nsummary,datRom,";
+			appendReportCsvString(report, check_fix_mode_s_pDatRom ? check_fix_mode_s_pDatRom->name.c_str() : "");
+			report += ",,\n";
+		}
+		for (size_t i = 0; i < sizeof(categories) / sizeof(categories[0]); i++) {
+			appendReport(report, "%s,%s,%d,,\n", categories[i].pszLevel, categories[i].pszName, categories[i].nCount);
+			forEachSectorRange(*categories[i].pSectors, [&](DWORD dwStart, DWORD dwEnd) {
+				appendReport(report, "range,%s,,%lu,%lu\n", categories[i].pszName, (ULONG)dwStart, (ULONG)dwEnd);
+			});
+		}
+		for (size_t i = 0; i < trackModeChanges.size(); i++) {
+			appendReport(report, "trackMode,%s,,%u,\n"
+				, trackModeName(trackModeChanges[i].trackMode), trackModeChanges[i].uiSector);
+		}
+	}
+
+	FILE* fpReport = fopen(reportPath, "wb");
+	if (!fpReport) {
+		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+		return FALSE;
+	}
+	BOOL bRet = fwrite(report.data(), 1, report.size(), fpReport) == report.size();
+	if (fclose(fpReport) || !bRet) {
+		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+		return FALSE;
 	}
 	return TRUE;
 }
 
+//
+// Progress of check on the console, redrawn at most every PROGRESS_INTERVAL_MS
+// and only when stdout is a terminal
+//
+typedef struct _PROGRESS {
+	BOOL bShow;
+	UINT uiFirst;
+	UINT uiLast;
+	UINT uiCalls;
+	UINT uiCurrent;
+	std::chrono::steady_clock::time_point tpStart;
+	std::chrono::steady_clock::time_point tpNext;
+} PROGRESS, *PPROGRESS;
+
+VOID startProgress(
+	PPROGRESS pProgress,
+	UINT uiFirst,
+	UINT uiLast
+) {
+#ifdef _WIN32
+	pProgress->bShow = _isatty(_fileno(stdout)) ? TRUE : FALSE;
+#else
+	pProgress->bShow = isatty(fileno(stdout)) ? TRUE : FALSE;
+#endif
+	pProgress->uiFirst = uiFirst;
+	pProgress->uiLast = uiLast;
+	pProgress->uiCalls = 0;
+	pProgress->uiCurrent = uiFirst;
+	pProgress->tpStart = std::chrono::steady_clock::now();
+	pProgress->tpNext = pProgress->tpStart;
+}
+
+VOID drawProgress(
+	PPROGRESS pProgress,
+	std::chrono::steady_clock::time_point tpNow
+) {
+	double dSeconds = std::chrono::duration<double>(tpNow - pProgress->tpStart).count();
+	UINT uiDone = pProgress->uiCurrent - pProgress->uiFirst + 1;
+	double dSectorsPerSec = dSeconds > 0 ? uiDone / dSeconds : 0;
+	UINT uiEta = 0;
+
+	if (pProgress->uiLast + 1 == pProgress->uiFirst) {
+		OutputString("\rChecking sectors: %6u, %8.2f MB/s, %9.0f sectors/s"
+			, pProgress->uiCurrent, dSectorsPerSec * CD_RAW_SECTOR_SIZE / 1000000, dSectorsPerSec);
+		fflush(stdout);
+		return;
+	}
+	if (dSectorsPerSec > 0) {
+		uiEta = (UINT)((pProgress->uiLast - pProgress->uiCurrent) / dSectorsPerSec);
+	}
+	OutputString("\rChecking sectors: %6u/%6u, %8.2f MB/s, %9.0f sectors/s, ETA %02u:%02u:%02u"
+		, pProgress->uiCurrent, pProgress->uiLast
+		, dSectorsPerSec * CD_RAW_SECTOR_SIZE / 1000000, dSectorsPerSec
+		, uiEta / 3600, uiEta / 60 % 60, uiEta % 60);
+	fflush(stdout);
+}
+
+// Cheap enough for every sector: the clock is only read every 64 calls
+VOID updateProgress(
+	PPROGRESS pProgress,
+	UINT uiCurrent
+) {
+	pProgress->uiCurrent = uiCurrent;
+	if (!pProgress->bShow || (pProgress->uiCalls++ & 63)) {
+		return;
+	}
+	std::chrono::steady_clock::time_point tpNow = std::chrono::steady_clock::now();
+	if (tpNow >= pProgress->tpNext) {
+		drawProgress(pProgress, tpNow);
+		pProgress->tpNext = tpNow + std::chrono::milliseconds(PROGRESS_INTERVAL_MS);
+	}
+}
+
+VOID endProgress(
+	PPROGRESS pProgress
+) {
+	if (pProgress->bShow) {
+		drawProgress(pProgress, std::chrono::steady_clock::now());
+		OutputString("\n");
+	}
+}
+
+//
+// handleCheckOrFix closes these on every way out, as verifydat calls it for
+// image after image
+//
+VOID closeCheckOrFixFiles(
+	FILE *fp,
+	FILE *fpCheckFile
+) {
+	fclose(fp);
+	if (fpCheckFile) {
+		fclose(fpCheckFile);
+	}
+	fclose(fpLog);
+}
+
 INT handleCheckOrFix(
 	LPCSTR filePath,
 	EXEC_TYPE execType,
@@ -667,14 +1843,15 @@ INT handleCheckOrFix(
 ) {
 	FILE* fp = NULL;
 
+	check_fix_mode_s_pDatRom = NULL;
 	if (execType == check || execType == checkex) {
 		if (NULL == (fp = fopen(filePath, "rb"))) {
 			OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
 			return EXIT_FAILURE;
 		}
 	}
-	else if (execType == fix) {
-		if (NULL == (fp = fopen(filePath, "rb+"))) {
+	else if (execType == fix || execType == correct) {
+		if (NULL == (fp = fopen(filePath, check_fix_mode_s_pszOutput || check_fix_mode_s_pszPatch ? "rb" : "rb+"))) {
 			OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
 			return EXIT_FAILURE;
 		}
@@ -714,15 +1891,11 @@ INT handleCheckOrFix(
 		OutputErrorString("If toc or sub file exists, this app can check the data sector precisely\n");
 	}
 
-	UINT roopSize = (UINT)GetFileSize(0, fp) / CD_RAW_SECTOR_SIZE;
+	// only for the progress and the queues; the image is read to its end
+	// whatever its size, and roopSize is then what was read
+	UINT64 ui64ImageSize = GetImageSize(fp);
+	UINT roopSize = (UINT)(ui64ImageSize / CD_RAW_SECTOR_SIZE);
 	ERROR_STRUCT errStruct;
-	if (!initCountNum(&errStruct, roopSize)) {
-		return EXIT_FAILURE;
-	}
-
-	if (startLBA == 0 && endLBA == 0) {
-		endLBA = roopSize;
-	}
 
 	BOOL skipTrackModeCheck = targetTrackMode == TrackModeUnknown;
 	TrackMode trackMode = targetTrackMode;
@@ -735,7 +1908,39 @@ INT handleCheckOrFix(
 	INT nPrevLBA = 0;
 	BOOL bBadMsf = FALSE;
 
-	BYTE buf[CD_RAW_SECTOR_SIZE] = {};
+	PIO_ENGINE pIoEngine = NULL;
+	if (check_fix_mode_s_IoUring && NULL == (pIoEngine = CreateIoEngine(check_fix_mode_s_QueueDepth))) {
+		OutputErrorString("io_uring is unavailable, reading without it\n");
+	}
+	IMAGE_READER imageReader;
+	IMAGE_READER checkFileReader;
+	if (fpCheckFile) {
+		if (pIoEngine && !strncmp(pszType, "Sub", 3)) {
+			OpenImageReader(&checkFileReader, fpCheckFile, CHECK_BATCH_SECTORS * 96, check_fix_mode_s_QueueDepth, pIoEngine);
+		}
+		else {
+			OpenImageReader(&checkFileReader, fpCheckFile, 0, 0, NULL);
+		}
+	}
+	size_t stRead = 0;
+	//
+	// Check runs in three stages: the image reader's thread reads ahead, this
+	// thread classifies the sectors a window at a time (spread over the pool
+	// with -j), and the log thread goes through the results in LBA order
+	// Windows go back and forth on lock-free queues sized for every window of
+	// the image, and a new one is made whenever none has come back yet, so
+	// classification never waits for the log (unless the size isn't known)
+	//
+	size_t stWindow = (size_t)CHECK_BATCH_SECTORS * check_fix_mode_s_Jobs;
+	size_t stWindows = ui64ImageSize ? (roopSize + stWindow - 1) / stWindow + 2 : CHECK_STREAM_WINDOWS;
+	std::deque<CHECK_WINDOW> checkWindows;
+	CHECK_WINDOW endWindow = {};
+	SpscQueue<PCHECK_WINDOW> filledWindows(stWindows);
+	SpscQueue<PCHECK_WINDOW> freeWindows(stWindows);
+	CLASSIFY_POOL classifyPool;
+	BOOL bReadError = FALSE;
+	PHASH_WORKER pHashWorker = NULL;
+	HASH_DIGESTS digests = {};
 	typedef struct _TRACK_DATA {
 		UCHAR Reserved;
 		UCHAR Control : 4;
@@ -751,18 +1956,26 @@ INT handleCheckOrFix(
 		TRACK_DATA TrackData[100];
 	} CDROM_TOC;
 	CDROM_TOC tocbuf = {};
-	BYTE subbuf[96] = {};
+	LPBYTE subbuf = NULL;
 	INT nTrkIdx = 0;
 	UINT n1stLBAinToc[100] = {};
 	UCHAR nCtlinToc[100] = {};
 	BOOL bSecuROM = FALSE;
 	UINT nSecuROMSector = 0;
+	std::vector<TRACK_MODE_CHANGE> trackModeChanges;
 
 	if (!strncmp(pszType, "TOC", 3)) {
-		if (!fpCheckFile || fread(&tocbuf, sizeof(BYTE), sizeof(tocbuf), fpCheckFile) < sizeof(tocbuf)) {
+		LPBYTE lpToc = fpCheckFile ? ReadImage(&checkFileReader, sizeof(tocbuf), &stRead) : NULL;
+		if (!lpToc || stRead < sizeof(tocbuf)) {
 			OutputErrorString("Failed to read [F:%s][L:%d]\n", __FUNCTION__, __LINE__);
+			if (fpCheckFile) {
+				CloseImageReader(&checkFileReader);
+			}
+			DestroyIoEngine(pIoEngine);
+			closeCheckOrFixFiles(fp, fpCheckFile);
 			return EXIT_FAILURE;
 		}
+		memcpy(&tocbuf, lpToc, sizeof(tocbuf));
 		for (INT i = tocbuf.FirstTrack - 1; i < tocbuf.LastTrack; i++) {
 			for (INT d = 0, k = 24; d < 4; d++, k -= 8) {
 				n1stLBAinToc[i] |= tocbuf.TrackData[i].Address[d] << k;
@@ -771,150 +1984,274 @@ INT handleCheckOrFix(
 //			OutputString("Trk %d, ctl %d lba %d\n", i + 1, nCtlinToc[i], n1stLBAinToc[i]);
 		}
 	}
-	for (UINT i = 0; i < roopSize; i++, j++) {
+	//
+	// The image is read ahead by another thread (or queued on io_uring) while
+	// the sectors are checked
+	//
+	if (pIoEngine) {
+		OpenImageReader(&imageReader, fp, CHECK_BATCH_SECTORS * CD_RAW_SECTOR_SIZE, check_fix_mode_s_QueueDepth, pIoEngine);
+	}
+	else {
+		OpenImageReader(&imageReader, fp, READ_AHEAD_CHUNK_SIZE, READ_AHEAD_CHUNKS, NULL);
+	}
+	PROGRESS progress;
+	// without a size, the last is just before the first and it shows no total
 #ifdef _WIN32
-		if (execType == checkex) {
-			i = j + startLBA;
-		}
+	if (execType == checkex) {
+		startProgress(&progress, startLBA, startLBA + roopSize - 1);
+	}
+	else {
 #endif
-		if (fread(buf, sizeof(BYTE), sizeof(buf), fp) < sizeof(buf)) {
-			OutputErrorString("Failed to read [F:%s][L:%d]\n", __FUNCTION__, __LINE__);
-		}
-		if (i == 0) {
-			nFirstLBA = MSFtoLBA(BcdToDec(buf[12]), BcdToDec(buf[13]), BcdToDec(buf[14]));
-		}
-		if (fpCheckFile) {
-			if (!strncmp(pszType, "TOC", 3)) {
-				if (n1stLBAinToc[nTrkIdx] == i) {
-//					OutputString("ctl %d lba %d\n", nCtlinToc[nTrkIdx], n1stLBAinToc[nTrkIdx]);
-					byCtl = nCtlinToc[nTrkIdx++];
-				}
+		startProgress(&progress, 0, roopSize - 1);
+#ifdef _WIN32
+	}
+#endif
+	std::thread logWriter([&] {
+		PCHECK_WINDOW pWindow = NULL;
+		PSECTOR_RESULT pResult = NULL;
+		size_t k = 0;
+
+		for (UINT i = 0;; i++, j++) {
+#ifdef _WIN32
+			if (execType == checkex) {
+				i = j + startLBA;
 			}
-			else if (!strncmp(pszType, "Sub", 3)) {
-				if (fread(subbuf, sizeof(BYTE), sizeof(subbuf), fpCheckFile) < sizeof(subbuf)) {
-					OutputErrorString("Failed to read [F:%s][L:%d]\n", __FUNCTION__, __LINE__);
-					return EXIT_FAILURE;
+#endif
+			if (!pWindow || ++k >= pWindow->stSectors) {
+				if (pWindow) {
+					freeWindows.push(pWindow);
 				}
-				byCtl = (BYTE)((subbuf[12] >> 4) & 0x0f);
+				pWindow = popCheckWindow(filledWindows);
+				if (pWindow->stSectors == 0) {
+					return;
+				}
+				k = 0;
 			}
-			if (byCtl & 0x04) {
-				if (nLBA > 0) {
-					if (bBadMsf) {
-						nPrevLBA++;
-						bBadMsf = FALSE;
-					}
-					else {
-						nPrevLBA = nLBA;
+			pResult = &pWindow->results[k];
+			if (check_fix_mode_s_Report != reportNone &&
+				(trackModeChanges.empty() || trackModeChanges.back().trackMode != pResult->trackMode)) {
+				trackModeChanges.push_back({ i, pResult->trackMode });
+			}
+			if (i == 0) {
+				nFirstLBA = MSFtoLBA(BcdToDec(pResult->msf[0]), BcdToDec(pResult->msf[1]), BcdToDec(pResult->msf[2]));
+			}
+			if (fpCheckFile) {
+				if (!strncmp(pszType, "TOC", 3)) {
+					if (n1stLBAinToc[nTrkIdx] == i) {
+//						OutputString("ctl %d lba %d\n", nCtlinToc[nTrkIdx], n1stLBAinToc[nTrkIdx]);
+						byCtl = nCtlinToc[nTrkIdx++];
 					}
 				}
-				BYTE m = 0, s = 0, f = 0;
-				if ((buf[13] & 0x80) == 0x80) {
-					nLBA = MSFtoLBA(BcdToDec(BYTE(buf[12] ^ 0x01)), BcdToDec(BYTE(buf[13] ^ 0x80)), BcdToDec(buf[14])) - 150;
-				}
-				else {
-					nLBA = MSFtoLBA(BcdToDec(buf[12]), BcdToDec(buf[13]), BcdToDec(buf[14])) - 150;
-					LBAtoMSF(nLBA + 150, &m, &s, &f);
+				else if (!strncmp(pszType, "Sub", 3)) {
+					byCtl = (BYTE)((pResult->subQ[0] >> 4) & 0x0f);
 				}
+				if (byCtl & 0x04) {
+					if (nLBA > 0) {
+						if (bBadMsf) {
+							nPrevLBA++;
+							bBadMsf = FALSE;
+						}
+						else {
+							nPrevLBA = nLBA;
+						}
+					}
+					BYTE m = 0, s = 0, f = 0;
+					if ((pResult->msf[1] & 0x80) == 0x80) {
+						nLBA = MSFtoLBA(BcdToDec(BYTE(pResult->msf[0] ^ 0x01)), BcdToDec(BYTE(pResult->msf[1] ^ 0x80)), BcdToDec(pResult->msf[2])) - 150;
+					}
+					else {
+						nLBA = MSFtoLBA(BcdToDec(pResult->msf[0]), BcdToDec(pResult->msf[1]), BcdToDec(pResult->msf[2])) - 150;
+						LBAtoMSF(nLBA + 150, &m, &s, &f);
+					}
 
-				if (nLBA == -150) {
-					nLBA = (INT)i;
-					nPrevLBA = (INT)i - 1;
-				}
+					if (nLBA == -150) {
+						nLBA = (INT)i;
+						nPrevLBA = (INT)i - 1;
+					}
 
-				if (m == BcdToDec(buf[12]) && s == BcdToDec(buf[13]) && f == BcdToDec(buf[14])) {
-					handleCheckDetail(&errStruct, execType, buf, skipTrackModeCheck, trackMode, (UINT)nLBA, j, TRUE, subbuf);
-				}
-				else if (nLBA > 0 && (prevCtl & 0x04) && nPrevLBA + 1 != nLBA) {
-					errStruct.badMsfNum[errStruct.cnt_BadMsf++] = i;
-					bBadMsf = TRUE;
-					OutputFileWithLbaMsf("bad msf\n", nPrevLBA + 1, nPrevLBA + 1, buf[12], buf[13], buf[14]);
+					if (m == BcdToDec(pResult->msf[0]) && s == BcdToDec(pResult->msf[1]) && f == BcdToDec(pResult->msf[2])) {
+						handleCheckDetail(&errStruct, pResult, skipTrackModeCheck, trackMode, (UINT)nLBA, TRUE);
+					}
+					else if (nLBA > 0 && (prevCtl & 0x04) && nPrevLBA + 1 != nLBA) {
+						errStruct.badMsfNum.push_back(i);
+						errStruct.cnt_BadMsf++;
+						bBadMsf = TRUE;
+						if (check_fix_mode_s_LogLevel != logLevelSummary) {
+							OutputFileWithLbaMsf("bad msf\n", nPrevLBA + 1, nPrevLBA + 1, pResult->msf[0], pResult->msf[1], pResult->msf[2]);
+						}
+					}
+					else {
+						if (nLBA == -150 && nPrevLBA != 0) {
+							// for audio sector of data track
+							nLBA = nPrevLBA + 1;
+						}
+						handleCheckDetail(&errStruct, pResult, skipTrackModeCheck, trackMode, (UINT)nLBA, TRUE);
+					}
 				}
 				else {
-					if (nLBA == -150 && nPrevLBA != 0) {
-						// for audio sector of data track
-						nLBA = nPrevLBA + 1;
+					if (i == 0) {
+						nFirstLBA = (INT)startLBA + 150;
+					}
+					if (check_fix_mode_s_LogLevel == logLevelFull) {
+						OutputFileWithLba("audio\n", nFirstLBA - 150 + i, nFirstLBA - 150 + i);
 					}
-					handleCheckDetail(&errStruct, execType, buf, skipTrackModeCheck, trackMode, (UINT)nLBA, j, TRUE, subbuf);
 				}
 			}
 			else {
-				if (i == 0) {
-					nFirstLBA = (INT)startLBA + 150;
-				}
-				OutputFileWithLba("audio\n", nFirstLBA - 150 + i, nFirstLBA - 150 + i);
+				handleCheckDetail(&errStruct, pResult, skipTrackModeCheck, trackMode, i, FALSE);
 			}
-		}
-		else {
-			handleCheckDetail(&errStruct, execType, buf, skipTrackModeCheck, trackMode, i, j, FALSE, subbuf);
-		}
 
-		prevMode[5] = prevMode[4];
-		prevMode[4] = prevMode[3];
-		prevMode[3] = prevMode[2];
-		prevMode[2] = prevMode[1];
-		prevMode[1] = prevMode[0];
-		prevMode[0] = buf[15];
+			prevMode[5] = prevMode[4];
+			prevMode[4] = prevMode[3];
+			prevMode[3] = prevMode[2];
+			prevMode[2] = prevMode[1];
+			prevMode[1] = prevMode[0];
+			prevMode[0] = pResult->mode;
 		
-		UINT tmplba = 0;
-		if (i == roopSize - 1) {
-			// last sector
-			if (((byCtl & 0x04) == 0x04) && prevMode[0] == prevMode[1] &&
-				prevMode[0] == prevMode[2] && prevMode[0] != prevMode[3]) {
-				bSecuROM = TRUE;
-				tmplba = roopSize - 4;
+			UINT tmplba = 0;
+			if (pWindow->bLast && k == pWindow->stSectors - 1) {
+				// last sector
+				if (((byCtl & 0x04) == 0x04) && prevMode[0] == prevMode[1] &&
+					prevMode[0] == prevMode[2] && prevMode[0] != prevMode[3]) {
+					bSecuROM = TRUE;
+					tmplba = i - 3;
+				}
 			}
-		}
-		else {
-			if (((prevCtl & 0x04) == 0x04) && prevMode[0] == 0 && prevMode[1] == prevMode[2] &&
-				prevMode[1] == prevMode[3] && prevMode[1] != prevMode[4] && prevMode[1] == prevMode[5]) {
-				bSecuROM = TRUE;
-				tmplba = i - 4;
+			else {
+				if (((prevCtl & 0x04) == 0x04) && prevMode[0] == 0 && prevMode[1] == prevMode[2] &&
+					prevMode[1] == prevMode[3] && prevMode[1] != prevMode[4] && prevMode[1] == prevMode[5]) {
+					bSecuROM = TRUE;
+					tmplba = i - 4;
+				}
 			}
+			if (bSecuROM) {
+				nSecuROMSector = tmplba;
+			}
+			prevCtl = byCtl;
+			updateProgress(&progress, i);
+		}
+	});
+
+	//
+	// Read and classify every window, and queue it for the log
+	//
+	if (check_fix_mode_s_Jobs > 1) {
+		startClassifyPool(&classifyPool, check_fix_mode_s_Jobs);
+	}
+	if (check_fix_mode_s_Hash) {
+		pHashWorker = StartHashWorker(check_fix_mode_s_Sha256);
+	}
+	//
+	// A window is queued once the next read has shown whether it's the last;
+	// a short read is the end of the image, and the bytes after its last whole
+	// sector are only hashed
+	//
+	PCHECK_WINDOW pPending = NULL;
+	UINT uiSectors = 0;
+	for (;;) {
+		LPBYTE lpWindow = ReadImage(&imageReader, stWindow * CD_RAW_SECTOR_SIZE, &stRead);
+		size_t stSectors = lpWindow ? stRead / CD_RAW_SECTOR_SIZE : 0;
+		PCHECK_WINDOW pWindow = NULL;
+
+		if (!lpWindow) {
+			break;
 		}
-		if (bSecuROM) {
-			nSecuROMSector = tmplba;
+		// hashed while the window is classified, and waited for before the
+		// next read, as that may reuse the buffer
+		if (pHashWorker) {
+			SubmitHashWorker(pHashWorker, lpWindow, stRead);
 		}
-		prevCtl = byCtl;
-
-#ifdef _WIN32
-		if (execType == checkex) {
-			OutputString("\rChecking sectors: %6u/%6u", i, startLBA + roopSize - 1);
+		if (stSectors) {
+			if (!freeWindows.pop(pWindow)) {
+				checkWindows.push_back(CHECK_WINDOW());
+				pWindow = &checkWindows.back();
+				pWindow->results.resize(stWindow);
+			}
+			if (classifyPool.workers.empty()) {
+				classifySectors(lpWindow, stSectors, pWindow->results.data());
+			}
+			else {
+				submitClassifyPool(&classifyPool, lpWindow, stSectors, pWindow->results.data());
+				waitClassifyPool(&classifyPool);
+			}
+		}
+		if (stSectors && fpCheckFile && !strncmp(pszType, "Sub", 3)) {
+			subbuf = ReadImage(&checkFileReader, stSectors * 96, &stRead);
+			if (!subbuf || stRead < stSectors * 96) {
+				// the sectors before the end of .sub are still logged
+				OutputErrorString("Failed to read [F:%s][L:%d]\n", __FUNCTION__, __LINE__);
+				bReadError = TRUE;
+				stSectors = subbuf ? stRead / 96 : 0;
+			}
+			for (size_t m = 0; m < stSectors; m++) {
+				memcpy(pWindow->results[m].subQ, subbuf + m * 96 + 12, sizeof(pWindow->results[m].subQ));
+			}
 		}
 		else {
-#endif
-			OutputString("\rChecking sectors: %6u/%6u", i, roopSize - 1);
-#ifdef _WIN32
+			for (size_t m = 0; m < stSectors; m++) {
+				ZeroMemory(pWindow->results[m].subQ, sizeof(pWindow->results[m].subQ));
+			}
 		}
-#endif
-	}
-	OutputString("\n");
-
-#ifdef _WIN32
-	INT nonZeroSyncIndexStart = 0;
-	INT nonZeroSyncIndexEnd = (INT)roopSize - 1;
-	if (execType == checkex) {
-		for (INT i = 0; i < (INT)roopSize; ++i, ++nonZeroSyncIndexStart) {
-			if (errStruct.zeroSyncNum[i] == 0xFFFFFFFF)
-				break;
+		if (pPending && stSectors) {
+			pushCheckWindow(filledWindows, pPending);
+			pPending = NULL;
 		}
-
-		for (INT i = (INT)roopSize - 1; i >= 0; --i, --nonZeroSyncIndexEnd) {
-			if (errStruct.zeroSyncNum[i] == 0xFFFFFFFF)
-				break;
+		if (stSectors) {
+			pWindow->stSectors = stSectors;
+			pWindow->bLast = FALSE;
+			pPending = pWindow;
+			uiSectors += (UINT)stSectors;
 		}
-
-
-		if (nonZeroSyncIndexStart != (INT)roopSize - 1) { // Empty track
-			assert(nonZeroSyncIndexStart <= nonZeroSyncIndexEnd);
-
-			for (INT i = nonZeroSyncIndexStart; i <= nonZeroSyncIndexEnd; ++i) {
-				if (errStruct.zeroSyncNum[i] != 0xFFFFFFFF) {
-					errStruct.cnt_ZeroSync++;
-				}
-			}
+		if (pHashWorker) {
+			WaitHashWorker(pHashWorker);
+		}
+		if (bReadError || stSectors < stWindow) {
+			break;
 		}
 	}
-#endif
+	if (imageReader.nError || (fpCheckFile && checkFileReader.nError)) {
+		// a failed read ends the reader like the end of the file does
+		OutputErrorString("Failed to read [F:%s][L:%d] %s\n", __FUNCTION__, __LINE__
+			, strerror(imageReader.nError ? imageReader.nError : checkFileReader.nError));
+		bReadError = TRUE;
+	}
+	// the file got shorter, or a read came up short
+	BOOL bShortRead = !bReadError && uiSectors < ui64ImageSize / CD_RAW_SECTOR_SIZE;
+	if (bShortRead) {
+		bReadError = TRUE;
+	}
+	if (pPending) {
+		pPending->bLast = !bReadError;
+		pushCheckWindow(filledWindows, pPending);
+	}
+	pushCheckWindow(filledWindows, &endWindow);
+	if (pHashWorker) {
+		StopHashWorker(pHashWorker, &digests);
+	}
+	logWriter.join();
+	if (bShortRead) {
+		OutputLog(standardError | file, "Failed to read: %u of %u sector(s) were read\n"
+			, uiSectors, (UINT)(ui64ImageSize / CD_RAW_SECTOR_SIZE));
+	}
+	roopSize = uiSectors;
+	if (startLBA == 0 && endLBA == 0) {
+		endLBA = roopSize;
+	}
+	double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - progress.tpStart).count();
+	if (!bReadError) {
+		endProgress(&progress);
+	}
+	stopClassifyPool(&classifyPool);
+	CloseImageReader(&imageReader);
+	if (fpCheckFile) {
+		CloseImageReader(&checkFileReader);
+	}
+	DestroyIoEngine(pIoEngine);
+	if (bReadError) {
+		closeCheckOrFixFiles(fp, fpCheckFile);
+		return EXIT_FAILURE;
+	}
+
 	if (errStruct.cnt_BadMsf) {
 		OutputLog(standardOut | file
 			, "[ERROR] Number of sector(s) where bad MSF: %d\n", errStruct.cnt_BadMsf);
@@ -1046,22 +2383,9 @@ INT handleCheckOrFix(
 		OutputLog(standardOut | file,
 			"[ERROR] Number of sector(s) where sync(0x00 - 0x0c) is zero: %d\n", errStruct.cnt_ZeroSync);
 		OutputFile("\tSector: ");
-#ifdef _WIN32
-		if (execType == checkex) {
-			for (INT i = nonZeroSyncIndexStart; i <= nonZeroSyncIndexEnd; ++i) {
-				if (errStruct.zeroSyncNum[i] != 0xFFFFFFFF) {
-					OutputFile("%ld, ", errStruct.zeroSyncNum[i]);
-				}
-			}
-		}
-		else {
-#endif
-			for (INT i = 0; i < errStruct.cnt_ZeroSync; i++) {
-				OutputFile("%ld, ", errStruct.zeroSyncNum[i]);
-			}
-#ifdef _WIN32
+		for (INT i = 0; i < errStruct.cnt_ZeroSync; i++) {
+			OutputFile("%ld, ", errStruct.zeroSyncNum[i]);
 		}
-#endif
 		OutputFile("\n");
 	}
 	if (fpCheckFile && errStruct.cnt_ZeroSyncPregap) {
@@ -1110,34 +2434,130 @@ INT handleCheckOrFix(
 		OutputLog(standardOut | file, "Total warnings: %d\n", warnings);
 	}
 
-	if (execType == fix) {
+	if (check_fix_mode_s_Hash) {
+		CHAR szDigest[65] = {};
+		OutputLog(standardOut | file, "Size: %llu\n", (unsigned long long)digests.ui64Size);
+		OutputLog(standardOut | file, "CRC32: %08x\n", digests.uiCrc32);
+		DigestToString(digests.md5, sizeof(digests.md5), szDigest);
+		OutputLog(standardOut | file, "MD5: %s\n", szDigest);
+		DigestToString(digests.sha1, sizeof(digests.sha1), szDigest);
+		OutputLog(standardOut | file, "SHA-1: %s\n", szDigest);
+		if (digests.bSha256) {
+			DigestToString(digests.sha256, sizeof(digests.sha256), szDigest);
+			OutputLog(standardOut | file, "SHA-256: %s\n", szDigest);
+		}
+	}
+	if (check_fix_mode_s_pDat) {
+		check_fix_mode_s_pDatRom = FindDatRom(check_fix_mode_s_pDat, &digests);
+		if (check_fix_mode_s_pDatRom) {
+			OutputLog(standardOut | file, "DAT: matches [%s] in [%s]\n"
+				, check_fix_mode_s_pDatRom->name.c_str(), check_fix_mode_s_pDatRom->game.c_str());
+		}
+		else {
+			OutputLog(standardOut | file, "DAT: no match\n");
+		}
+	}
+
+	if (check_fix_mode_s_Report != reportNone) {
+		std::string reportPath(logFilePath);
+		if (reportPath.size() > 4 && !strcmp(reportPath.c_str() + reportPath.size() - 4, ".txt")) {
+			reportPath.resize(reportPath.size() - 4);
+		}
+		reportPath += check_fix_mode_s_Report == reportJson ? ".json" : ".csv";
+		writeReport(reportPath.c_str(), filePath, &errStruct, roopSize, dSeconds
+			, bSecuROM, nSecuROMSector, trackModeChanges, check_fix_mode_s_Hash ? &digests : NULL);
+	}
+
+	FILE* fpFix = fp;
+	if ((execType == fix || execType == correct) && check_fix_mode_s_pszOutput) {
+		LPCSTR pszHow = CopyImage(fp, filePath, check_fix_mode_s_pszOutput);
+		if (!pszHow || NULL == (fpFix = fopen(check_fix_mode_s_pszOutput, "rb+"))) {
+			OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+			OutputErrorString("Failed to copy to %s\n", check_fix_mode_s_pszOutput);
+			closeCheckOrFixFiles(fp, fpCheckFile);
+			return EXIT_FAILURE;
+		}
+		OutputLog(standardOut | file, "Copied to %s (%s)\n", check_fix_mode_s_pszOutput, pszHow);
+	}
+	std::string patch;
+	std::string journal;
+	std::string journalPath = std::string(filePath) + "_EccEdc.undo";
+	// only the image itself needs a way back
+	BOOL bJournal = (execType == fix || execType == correct) &&
+		!check_fix_mode_s_pszOutput && !check_fix_mode_s_pszPatch;
+	INT retVal = EXIT_SUCCESS;
+	if (check_fix_mode_s_pszPatch || bJournal) {
+		beginPatch(patch, GetImageSize(fp));
+	}
+	if (bJournal) {
+		beginPatch(journal, GetImageSize(fp));
+	}
+	if (execType == fix || execType == correct) {
 		if (errStruct.cnt_Mode1BadEcc ||
 			errStruct.cnt_Mode2SubheaderNotSame ||
 			errStruct.cnt_NonZeroInvalidSync) {
 			INT fixedCnt = 0;
+			INT correctedCnt = 0;
+
+			std::vector<const std::vector<DWORD>*> errorLists;
 
 			if (errStruct.cnt_Mode1BadEcc) {
-				fixedCnt += fixSectorsFromArray(execType, fp
-					, errStruct.noMatchLBANum, errStruct.cnt_Mode1BadEcc, startLBA, endLBA);
+				errorLists.push_back(&errStruct.noMatchLBANum);
 			}
 			if (errStruct.cnt_Mode2SubheaderNotSame) {
-				fixedCnt += fixSectorsFromArray(execType, fp
-					, errStruct.mode2Num, errStruct.cnt_Mode2SubheaderNotSame, startLBA, endLBA);
+				errorLists.push_back(&errStruct.mode2Num);
 			}
 			if (errStruct.cnt_NonZeroInvalidSync) {
-				fixedCnt += fixSectorsFromArray(execType, fp
-					, errStruct.nonZeroInvalidSyncNum, errStruct.cnt_NonZeroInvalidSync, startLBA, endLBA);
+				errorLists.push_back(&errStruct.nonZeroInvalidSyncNum);
+			}
+			BOOL bJournaled = FALSE;
+			if (!fixSectors(execType, fpFix, errorLists, startLBA, endLBA, &fixedCnt, &correctedCnt
+				, check_fix_mode_s_pszPatch || bJournal ? &patch : NULL, bJournal ? &journal : NULL)) {
+				OutputErrorString("Failed to fix %s\n", fpFix != fp ? check_fix_mode_s_pszOutput : filePath);
+				retVal = EXIT_FAILURE;
+			}
+			else if (bJournal && journal.size() > PATCH_MAGIC_SIZE + sizeof(UINT64)) {
+				endPatch(patch);
+				endPatch(journal);
+				// the image is as it was, so there's nothing to count
+				if (!applyPatchWithJournal(fpFix, journalPath.c_str(), patch, journal)) {
+					retVal = EXIT_FAILURE;
+				}
+				else {
+					bJournaled = TRUE;
+				}
+			}
+			if (retVal == EXIT_SUCCESS) {
+				if (execType == correct) {
+					OutputLog(standardOut | file, "%d unmatch sector is corrected by ecc\n", correctedCnt);
+				}
+				OutputLog(standardOut | file, "%d unmatch sector is replaced at 0x55 except header\n", fixedCnt);
+			}
+			if (bJournaled) {
+				OutputLog(standardOut | file, "Undo journal: %s (%lu bytes)\n", journalPath.c_str(), (ULONG)journal.size());
 			}
-			OutputLog(standardOut | file, "%d unmatch sector is replaced at 0x55 except header\n", fixedCnt);
 		}
 	}
-	terminateCountNum(&errStruct);
-	fclose(fp);
-	if (fpCheckFile) {
-		fclose(fpCheckFile);
+	if (check_fix_mode_s_pszPatch && retVal == EXIT_SUCCESS) {
+		endPatch(patch);
+		if (!writePatch(check_fix_mode_s_pszPatch, patch)) {
+			OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+			OutputErrorString("Failed to write %s\n", check_fix_mode_s_pszPatch);
+			retVal = EXIT_FAILURE;
+		}
+		else {
+			OutputLog(standardOut | file, "Patch: %s (%lu bytes)\n", check_fix_mode_s_pszPatch, (ULONG)patch.size());
+		}
 	}
-	fclose(fpLog);
-	return EXIT_SUCCESS;
+	if (fpFix != fp) {
+		fclose(fpFix);
+		if (retVal != EXIT_SUCCESS) {
+			// don't leave a copy that looks fixed
+			remove(check_fix_mode_s_pszOutput);
+		}
+	}
+	closeCheckOrFixFiles(fp, fpCheckFile);
+	return retVal;
 }
 #ifdef _WIN32
 INT handleCheckEx(
@@ -1235,6 +2655,160 @@ INT handleCheckEx(
 	return retVal;
 }
 #endif
+//
+// Sub when the image has a .sub (found the way handleCheckOrFix does), TOC
+// when it has a .toc, and Sub otherwise, which checks without either
+//
+LPCSTR getCheckType(
+	LPCSTR filePath
+) {
+	CHAR path[_MAX_PATH] = {};
+	CHAR drive[_MAX_DRIVE] = {};
+	CHAR dir[_MAX_DIR] = {};
+	CHAR fname[_MAX_FNAME] = {};
+	CHAR tmpFname[_MAX_FNAME] = {};
+	_splitpath(filePath, drive, dir, fname, NULL);
+	strncpy(tmpFname, fname, _MAX_FNAME);
+	PCHAR addr = strstr(tmpFname, " (Subs control)");
+	if (addr) {
+		tmpFname[addr - tmpFname] = 0;
+	}
+	_makepath(path, drive, dir, tmpFname, ".sub");
+	FILE* fpCheckFile = fopen(path, "rb");
+	if (fpCheckFile) {
+		fclose(fpCheckFile);
+		return "Sub";
+	}
+	_makepath(path, drive, dir, fname, ".toc");
+	if (NULL != (fpCheckFile = fopen(path, "rb"))) {
+		fclose(fpCheckFile);
+		return "TOC";
+	}
+	return "Sub";
+}
+
+//
+// The DAT is read and indexed once, then every image is checked and hashed in
+// the same pass, and looked up in it
+//
+INT handleVerifyDat(
+	LPCSTR datPath,
+	INT nImages,
+	char* images[]
+) {
+	DAT_INDEX datIndex;
+
+	if (!LoadDat(datPath, &datIndex)) {
+		OutputErrorString("Failed to read [%s], or it has no rom with size and crc\n", datPath);
+		return EXIT_FAILURE;
+	}
+	OutputString("%lu roms in %s\n", (ULONG)datIndex.roms.size(), datPath);
+	check_fix_mode_s_Hash = TRUE;
+	check_fix_mode_s_pDat = &datIndex;
+
+	INT nMatched = 0;
+	INT nFailed = 0;
+	for (INT i = 0; i < nImages; i++) {
+		std::string logFilePath = std::string(images[i]) + "_EccEdc.txt";
+
+		OutputString("[%d/%d] %s\n", i + 1, nImages, images[i]);
+		if (handleCheckOrFix(images[i], check, getCheckType(images[i])
+			, 0, 0, TrackModeUnknown, logFilePath.c_str()) != EXIT_SUCCESS) {
+			OutputString("Cannot check: %s\n", images[i]);
+			nFailed++;
+		}
+		else if (check_fix_mode_s_pDatRom) {
+			nMatched++;
+		}
+	}
+	check_fix_mode_s_pDat = NULL;
+	OutputString("Matched: %d/%d", nMatched, nImages);
+	if (nFailed) {
+		OutputString(", cannot check: %d", nFailed);
+	}
+	OutputString("\n");
+	return nMatched == nImages ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//
+// Applies a patch of fix --patch to the image, or with --output to a copy
+//
+INT handleApplyPatch(
+	LPCSTR patchPath,
+	LPCSTR filePath
+) {
+	std::string patch;
+
+	if (!readPatch(patchPath, patch)) {
+		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+		OutputErrorString("Failed to read %s\n", patchPath);
+		return EXIT_FAILURE;
+	}
+	FILE* fp = fopen(filePath, check_fix_mode_s_pszOutput ? "rb" : "rb+");
+	if (!fp) {
+		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+		return EXIT_FAILURE;
+	}
+	FILE* fpApply = fp;
+	if (check_fix_mode_s_pszOutput) {
+		LPCSTR pszHow = CopyImage(fp, filePath, check_fix_mode_s_pszOutput);
+		if (!pszHow || NULL == (fpApply = fopen(check_fix_mode_s_pszOutput, "rb+"))) {
+			OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+			OutputErrorString("Failed to copy to %s\n", check_fix_mode_s_pszOutput);
+			fclose(fp);
+			return EXIT_FAILURE;
+		}
+		OutputString("Copied to %s (%s)\n", check_fix_mode_s_pszOutput, pszHow);
+	}
+	DWORD dwSectors = 0;
+	BOOL bRet = applyPatch(fpApply, patch, &dwSectors);
+	if (bRet) {
+		OutputString("%lu sector is patched\n", (ULONG)dwSectors);
+	}
+	if (fpApply != fp) {
+		fclose(fpApply);
+		if (!bRet) {
+			// don't leave a copy that looks patched
+			remove(check_fix_mode_s_pszOutput);
+		}
+	}
+	fclose(fp);
+	return bRet ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//
+// Puts back the sectors that the last in-place fix/correct overwrote, from its
+// journal, and removes the journal
+//
+INT handleUnfix(
+	LPCSTR filePath
+) {
+	std::string journal;
+	std::string journalPath = std::string(filePath) + "_EccEdc.undo";
+
+	if (!readPatch(journalPath.c_str(), journal)) {
+		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+		OutputErrorString("Failed to read %s\n", journalPath.c_str());
+		return EXIT_FAILURE;
+	}
+	FILE* fp = fopen(filePath, "rb+");
+	if (!fp) {
+		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+		return EXIT_FAILURE;
+	}
+	DWORD dwSectors = 0;
+	BOOL bRet = applyPatch(fp, journal, &dwSectors);
+	fclose(fp);
+	if (!bRet) {
+		return EXIT_FAILURE;
+	}
+	OutputString("%lu sector is restored\n", (ULONG)dwSectors);
+	if (remove(journalPath.c_str())) {
+		OutputLastErrorNumAndString(__FUNCTION__, __LINE__);
+	}
+	return EXIT_SUCCESS;
+}
+
 INT handleWrite(
 	LPCSTR filePath
 ) {
@@ -1287,12 +2861,41 @@ VOID printUsage(
 		"\t\tReplace data of 2336 byte to '0x55' except header\n"
 		"\tfix <Type> <InOutFileName> <startLBA> <endLBA>\n"
 		"\t\tReplace data of 2336 byte to '0x55' except header from <startLBA> to <endLBA>\n"
+		"\tcorrect <Type> <InOutFileName>\n"
+		"\t\tCorrect data of 2336 byte by ecc, or replace it to '0x55' except header if it can't be\n"
+		"\tcorrect <Type> <InOutFileName> <startLBA> <endLBA>\n"
+		"\t\tCorrect data of 2336 byte by ecc, or replace it to '0x55' except header if it can't be,\n"
+		"\t\tfrom <startLBA> to <endLBA>\n"
+		"\tverifydat <DatFile> <InFileName>...\n"
+		"\t\tCheck and hash every file, and look it up in a redump DAT (xml or clrmamepro)\n"
+		"\tapplypatch <PatchFile> <InOutFileName>\n"
+		"\t\tApply a patch written by fix/correct --patch\n"
+		"\tunfix <InOutFileName>\n"
+		"\t\tPut back the sectors the last fix/correct overwrote, from <InOutFileName>_EccEdc.undo\n"
 		"\twrite <OutFileName> <Minute> <Second> <Frame> <Mode> <CreateSectorNum>\n"
 		"\t\tCreate a 2352 byte per sector with sync, addr, mode, ecc, edc. (User data is all zero)\n"
 		"\t\tMode\t1: mode 1, 2: mode 2 form 1, 3: mode 2 form 2\n"
 		"Argument\n"
 		"\tType\tTOC: Sector is checked using .toc\n"
 		"\t    \tSub: Sector is checked using .sub\n"
+		"Option (check, checkex, fix, correct, verifydat)\n"
+		"\t-j <Num>\n"
+		"\t\tThreads classifying the sectors (1 to 256, default 1)\n"
+		"\t--log-level <Level>\n"
+		"\t\tsummary: only the counts and sector lists, errors: also a line for each sector\n"
+		"\t\tin the lists, full: a line for every sector (default)\n"
+		"\t--report <Format>\n"
+		"\t\tjson or csv: also write the counts, sector ranges and timing next to the log\n"
+		"\t--hash\n"
+		"\t\tAlso compute the crc32, md5 and sha-1 of the image as it's read\n"
+		"\t--sha256\n"
+		"\t\tSame as --hash, plus sha-256\n"
+		"\t--output <OutFileName>\n"
+		"\t\tfix/correct a copy of the image (a reflink where the file system allows it)\n"
+		"\t\tand leave the image as it is (applypatch too)\n"
+		"\t--patch <PatchFile>\n"
+		"\t\tfix/correct write what they would change to a patch of a few KB, for applypatch,\n"
+		"\t\tand leave the image as it is\n"
 	);
 	system("pause");
 #else
@@ -1304,16 +2907,127 @@ VOID printUsage(
 		"\t\tReplace data of 2336 byte to '0x55' except header\n"
 		"\tfix <Type> <InOutFileName> <startLBA> <endLBA>\n"
 		"\t\tReplace data of 2336 byte to '0x55' except header from <startLBA> to <endLBA>\n"
+		"\tcorrect <Type> <InOutFileName>\n"
+		"\t\tCorrect data of 2336 byte by ecc, or replace it to '0x55' except header if it can't be\n"
+		"\tcorrect <Type> <InOutFileName> <startLBA> <endLBA>\n"
+		"\t\tCorrect data of 2336 byte by ecc, or replace it to '0x55' except header if it can't be,\n"
+		"\t\tfrom <startLBA> to <endLBA>\n"
+		"\tverifydat <DatFile> <InFileName>...\n"
+		"\t\tCheck and hash every file, and look it up in a redump DAT (xml or clrmamepro)\n"
+		"\tapplypatch <PatchFile> <InOutFileName>\n"
+		"\t\tApply a patch written by fix/correct --patch\n"
+		"\tunfix <InOutFileName>\n"
+		"\t\tPut back the sectors the last fix/correct overwrote, from <InOutFileName>_EccEdc.undo\n"
 		"\twrite <OutFileName> <Minute> <Second> <Frame> <Mode> <CreateSectorNum>\n"
 		"\t\tCreate a 2352 byte per sector with sync, addr, mode, ecc, edc. (User data is all zero)\n"
 		"\t\tMode\t1: mode 1, 2: mode 2 form 1, 3: mode 2 form 2\n"
 		"Argument\n"
 		"\tType\tTOC: Sector is checked using .toc\n"
 		"\t    \tSub: Sector is checked using .sub\n"
+		"Option (check, fix, correct, verifydat)\n"
+		"\t--io-uring\n"
+		"\t\tRead the image and .sub with io_uring (Linux), if the kernel allows it\n"
+		"\t--queue-depth <Num>\n"
+		"\t\tReads kept in flight per file with --io-uring (2 to 1024, default 16)\n"
+		"\t-j <Num>\n"
+		"\t\tThreads classifying the sectors (1 to 256, default 1)\n"
+		"\t--log-level <Level>\n"
+		"\t\tsummary: only the counts and sector lists, errors: also a line for each sector\n"
+		"\t\tin the lists, full: a line for every sector (default)\n"
+		"\t--report <Format>\n"
+		"\t\tjson or csv: also write the counts, sector ranges and timing next to the log\n"
+		"\t--hash\n"
+		"\t\tAlso compute the crc32, md5 and sha-1 of the image as it's read\n"
+		"\t--sha256\n"
+		"\t\tSame as --hash, plus sha-256\n"
+		"\t--output <OutFileName>\n"
+		"\t\tfix/correct a copy of the image (a reflink where the file system allows it)\n"
+		"\t\tand leave the image as it is (applypatch too)\n"
+		"\t--patch <PatchFile>\n"
+		"\t\tfix/correct write what they would change to a patch of a few KB, for applypatch,\n"
+		"\t\tand leave the image as it is\n"
 	);
 #endif
 }
 
+//
+// Takes the options out of argv, so that checkArg only sees the arguments
+//
+INT checkOption(
+	INT* pArgc,
+	char* argv[]
+) {
+	PCHAR endptr = NULL;
+	INT nArgc = 1;
+
+	for (INT i = 1; i < *pArgc; i++) {
+		if (!strcmp(argv[i], "--io-uring")) {
+			check_fix_mode_s_IoUring = TRUE;
+		}
+		else if (!strcmp(argv[i], "--queue-depth") && i + 1 < *pArgc) {
+			check_fix_mode_s_QueueDepth = (UINT)strtoul(argv[++i], &endptr, 10);
+			if (*endptr || check_fix_mode_s_QueueDepth < 2 || check_fix_mode_s_QueueDepth > 1024) {
+				OutputErrorString("[%s] is invalid argument. Please input integer from 2 to 1024.\n", argv[i]);
+				return FALSE;
+			}
+		}
+		else if (!strcmp(argv[i], "--log-level") && i + 1 < *pArgc) {
+			i++;
+			if (!strcmp(argv[i], "summary")) {
+				check_fix_mode_s_LogLevel = logLevelSummary;
+			}
+			else if (!strcmp(argv[i], "errors")) {
+				check_fix_mode_s_LogLevel = logLevelErrors;
+			}
+			else if (!strcmp(argv[i], "full")) {
+				check_fix_mode_s_LogLevel = logLevelFull;
+			}
+			else {
+				OutputErrorString("[%s] is invalid argument. Please input summary, errors or full.\n", argv[i]);
+				return FALSE;
+			}
+		}
+		else if (!strcmp(argv[i], "--report") && i + 1 < *pArgc) {
+			i++;
+			if (!strcmp(argv[i], "json")) {
+				check_fix_mode_s_Report = reportJson;
+			}
+			else if (!strcmp(argv[i], "csv")) {
+				check_fix_mode_s_Report = reportCsv;
+			}
+			else {
+				OutputErrorString("[%s] is invalid argument. Please input json or csv.\n", argv[i]);
+				return FALSE;
+			}
+		}
+		else if (!strcmp(argv[i], "--hash")) {
+			check_fix_mode_s_Hash = TRUE;
+		}
+		else if (!strcmp(argv[i], "--sha256")) {
+			check_fix_mode_s_Hash = TRUE;
+			check_fix_mode_s_Sha256 = TRUE;
+		}
+		else if (!strcmp(argv[i], "--output") && i + 1 < *pArgc) {
+			check_fix_mode_s_pszOutput = argv[++i];
+		}
+		else if (!strcmp(argv[i], "--patch") && i + 1 < *pArgc) {
+			check_fix_mode_s_pszPatch = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-j") && i + 1 < *pArgc) {
+			check_fix_mode_s_Jobs = (UINT)strtoul(argv[++i], &endptr, 10);
+			if (*endptr || check_fix_mode_s_Jobs < 1 || check_fix_mode_s_Jobs > 256) {
+				OutputErrorString("[%s] is invalid argument. Please input integer from 1 to 256.\n", argv[i]);
+				return FALSE;
+			}
+		}
+		else {
+			argv[nArgc++] = argv[i];
+		}
+	}
+	*pArgc = nArgc;
+	return TRUE;
+}
+
 INT checkArg(
 	INT argc,
 	char* argv[],
@@ -1333,7 +3047,10 @@ INT checkArg(
 	else if (argc == 4 && (!strcmp(argv[1], "fix"))) {
 		*pExecType = fix;
 	}
-	else if (argc == 6 && (!strcmp(argv[1], "fix"))) {
+	else if (argc == 4 && (!strcmp(argv[1], "correct"))) {
+		*pExecType = correct;
+	}
+	else if (argc == 6 && (!strcmp(argv[1], "fix") || !strcmp(argv[1], "correct"))) {
 		check_fix_mode_s_startLBA = (UINT)strtoul(argv[4], &endptr, 10);
 		if (*endptr) {
 			OutputErrorString("[%s] is invalid argument. Please input integer.\n", endptr);
@@ -1345,7 +3062,16 @@ INT checkArg(
 			OutputErrorString("[%s] is invalid argument. Please input integer.\n", endptr);
 			return FALSE;
 		}
-		*pExecType = fix;
+		*pExecType = !strcmp(argv[1], "fix") ? fix : correct;
+	}
+	else if (argc >= 4 && (!strcmp(argv[1], "verifydat"))) {
+		*pExecType = verifydat;
+	}
+	else if (argc == 4 && (!strcmp(argv[1], "applypatch"))) {
+		*pExecType = applypatch;
+	}
+	else if (argc == 3 && (!strcmp(argv[1], "unfix"))) {
+		*pExecType = unfix;
 	}
 	else if (argc == 8 && (!strcmp(argv[1], "write"))) {
 		write_mode_s_Minute = (BYTE)strtoul(argv[3], &endptr, 10);
@@ -1390,16 +3116,22 @@ int main(int argc, char** argv)
 {
 	EXEC_TYPE execType;
 
-	if (!checkArg(argc, argv, &execType)) {
+	if (!checkOption(&argc, argv) || !checkArg(argc, argv, &execType)) {
 		printUsage();
 		return EXIT_FAILURE;
 	}
-
-	eccedc_init(); // Initialize the ECC/EDC tables
+	if (check_fix_mode_s_pszOutput && execType != fix && execType != correct && execType != applypatch) {
+		OutputErrorString("--output is only for fix, correct and applypatch\n");
+		return EXIT_FAILURE;
+	}
+	if (check_fix_mode_s_pszPatch && ((execType != fix && execType != correct) || check_fix_mode_s_pszOutput)) {
+		OutputErrorString("--patch is only for fix and correct, without --output\n");
+		return EXIT_FAILURE;
+	}
 
 	INT retVal = EXIT_FAILURE;
 
-	if (execType == check || execType == fix) {
+	if (execType == check || execType == fix || execType == correct) {
 		std::string logFilePath = std::string(argv[3]) + "_EccEdc.txt";
 
 		retVal = handleCheckOrFix(argv[3], execType, argv[2]
@@ -1410,6 +3142,15 @@ int main(int argc, char** argv)
 		retVal = handleCheckEx(argv[2], argv[2]);
 	}
 #endif
+	else if (execType == verifydat) {
+		retVal = handleVerifyDat(argv[2], argc - 3, argv + 3);
+	}
+	else if (execType == applypatch) {
+		retVal = handleApplyPatch(argv[2], argv[3]);
+	}
+	else if (execType == unfix) {
+		retVal = handleUnfix(argv[2]);
+	}
 	else if (execType == _write) {
 		retVal = handleWrite(argv[2]);
 	}
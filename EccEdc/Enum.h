@@ -56,9 +56,32 @@ typedef enum _EXEC_TYPE {
 	check,
 	checkex,
 	fix,
+	correct,
+	verifydat,
+	applypatch,
+	unfix,
 	_write
 } EXEC_TYPE, *PEXEC_TYPE;
 
+typedef enum _LOG_LEVEL {
+	logLevelSummary,
+	logLevelErrors,
+	logLevelFull
+} LOG_LEVEL, *PLOG_LEVEL;
+
+typedef enum _REPORT_TYPE {
+	reportNone,
+	reportJson,
+	reportCsv
+} REPORT_TYPE, *PREPORT_TYPE;
+
+typedef enum _PATCH_RECORD {
+	patchEnd,
+	patchFill55,
+	patchBytes,
+	patchSectors
+} PATCH_RECORD, *PPATCH_RECORD;
+
 typedef enum _LOG_TYPE {
 	standardOut = 1,
 	standardError = 1 << 1,
@@ -0,0 +1,519 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "Hash.hpp"
+
+// Every digest goes over this much of a buffer before the next one starts, so
+// that the data is still in the cache
+#define HASH_STEP_SIZE	(64 * 1024)
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// CRC32 (reflected 0xEDB88320), slice-by-8
+//
+////////////////////////////////////////////////////////////////////////////////
+typedef struct _CRC32_LUT {
+	UINT table[8][256];
+} CRC32_LUT;
+
+static CRC32_LUT Crc32MakeLut(void) {
+	CRC32_LUT lut;
+	for (UINT i = 0; i < 256; i++) {
+		UINT crc = i;
+		for (INT j = 0; j < 8; j++) {
+			crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320u : 0);
+		}
+		lut.table[0][i] = crc;
+	}
+	for (UINT i = 0; i < 256; i++) {
+		for (INT k = 1; k < 8; k++) {
+			UINT prev = lut.table[k - 1][i];
+			lut.table[k][i] = (prev >> 8) ^ lut.table[0][prev & 0xff];
+		}
+	}
+	return lut;
+}
+
+// Built before main, so the worker only ever reads it
+static const CRC32_LUT crc32Lut = Crc32MakeLut();
+
+UINT Crc32Update(
+	UINT crc,
+	const BYTE* lpBuf,
+	size_t stSize
+) {
+	crc = ~crc;
+	for (; stSize >= 8; lpBuf += 8, stSize -= 8) {
+		UINT lo = crc ^ (lpBuf[0] | lpBuf[1] << 8 | lpBuf[2] << 16 | (UINT)lpBuf[3] << 24);
+		UINT hi = lpBuf[4] | lpBuf[5] << 8 | lpBuf[6] << 16 | (UINT)lpBuf[7] << 24;
+		crc = crc32Lut.table[7][lo & 0xff] ^ crc32Lut.table[6][(lo >> 8) & 0xff] ^
+			crc32Lut.table[5][(lo >> 16) & 0xff] ^ crc32Lut.table[4][lo >> 24] ^
+			crc32Lut.table[3][hi & 0xff] ^ crc32Lut.table[2][(hi >> 8) & 0xff] ^
+			crc32Lut.table[1][(hi >> 16) & 0xff] ^ crc32Lut.table[0][hi >> 24];
+	}
+	for (; stSize; lpBuf++, stSize--) {
+		crc = (crc >> 8) ^ crc32Lut.table[0][(crc ^ *lpBuf) & 0xff];
+	}
+	return ~crc;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// MD5, SHA-1 and SHA-256 share the 64-byte block buffering
+//
+////////////////////////////////////////////////////////////////////////////////
+typedef struct _BLOCK_HASH {
+	UINT state[8];
+	BYTE block[64];
+	size_t stUsed;
+	UINT64 ui64Bytes;
+} BLOCK_HASH, *PBLOCK_HASH;
+
+typedef VOID (*BLOCK_FUNC)(UINT* state, const BYTE* lpBlock);
+
+static inline UINT Rol(UINT x, INT n) {
+	return (x << n) | (x >> (32 - n));
+}
+
+static inline UINT Ror(UINT x, INT n) {
+	return (x >> n) | (x << (32 - n));
+}
+
+static inline UINT LoadLe(const BYTE* p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (UINT)p[3] << 24;
+}
+
+static inline UINT LoadBe(const BYTE* p) {
+	return (UINT)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+// The rounds are spelled out, as loops with a switch on the round cost MD5 and
+// SHA-1 more than half their speed
+
+#define MD5_STEP(f, a, b, c, d, m, k, r) \
+	a += f(b, c, d) + (m) + (k); \
+	a = Rol(a, r) + b
+
+#define MD5_F(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define MD5_G(x, y, z)	((y) ^ ((z) & ((x) ^ (y))))
+#define MD5_H(x, y, z)	((x) ^ (y) ^ (z))
+#define MD5_I(x, y, z)	((y) ^ ((x) | ~(z)))
+
+static VOID Md5Block(
+	UINT* state,
+	const BYTE* lpBlock
+) {
+	UINT m[16];
+	for (INT i = 0; i < 16; i++) {
+		m[i] = LoadLe(lpBlock + i * 4);
+	}
+	UINT a = state[0], b = state[1], c = state[2], d = state[3];
+
+	MD5_STEP(MD5_F, a, b, c, d, m[0], 0xd76aa478, 7);
+	MD5_STEP(MD5_F, d, a, b, c, m[1], 0xe8c7b756, 12);
+	MD5_STEP(MD5_F, c, d, a, b, m[2], 0x242070db, 17);
+	MD5_STEP(MD5_F, b, c, d, a, m[3], 0xc1bdceee, 22);
+	MD5_STEP(MD5_F, a, b, c, d, m[4], 0xf57c0faf, 7);
+	MD5_STEP(MD5_F, d, a, b, c, m[5], 0x4787c62a, 12);
+	MD5_STEP(MD5_F, c, d, a, b, m[6], 0xa8304613, 17);
+	MD5_STEP(MD5_F, b, c, d, a, m[7], 0xfd469501, 22);
+	MD5_STEP(MD5_F, a, b, c, d, m[8], 0x698098d8, 7);
+	MD5_STEP(MD5_F, d, a, b, c, m[9], 0x8b44f7af, 12);
+	MD5_STEP(MD5_F, c, d, a, b, m[10], 0xffff5bb1, 17);
+	MD5_STEP(MD5_F, b, c, d, a, m[11], 0x895cd7be, 22);
+	MD5_STEP(MD5_F, a, b, c, d, m[12], 0x6b901122, 7);
+	MD5_STEP(MD5_F, d, a, b, c, m[13], 0xfd987193, 12);
+	MD5_STEP(MD5_F, c, d, a, b, m[14], 0xa679438e, 17);
+	MD5_STEP(MD5_F, b, c, d, a, m[15], 0x49b40821, 22);
+
+	MD5_STEP(MD5_G, a, b, c, d, m[1], 0xf61e2562, 5);
+	MD5_STEP(MD5_G, d, a, b, c, m[6], 0xc040b340, 9);
+	MD5_STEP(MD5_G, c, d, a, b, m[11], 0x265e5a51, 14);
+	MD5_STEP(MD5_G, b, c, d, a, m[0], 0xe9b6c7aa, 20);
+	MD5_STEP(MD5_G, a, b, c, d, m[5], 0xd62f105d, 5);
+	MD5_STEP(MD5_G, d, a, b, c, m[10], 0x02441453, 9);
+	MD5_STEP(MD5_G, c, d, a, b, m[15], 0xd8a1e681, 14);
+	MD5_STEP(MD5_G, b, c, d, a, m[4], 0xe7d3fbc8, 20);
+	MD5_STEP(MD5_G, a, b, c, d, m[9], 0x21e1cde6, 5);
+	MD5_STEP(MD5_G, d, a, b, c, m[14], 0xc33707d6, 9);
+	MD5_STEP(MD5_G, c, d, a, b, m[3], 0xf4d50d87, 14);
+	MD5_STEP(MD5_G, b, c, d, a, m[8], 0x455a14ed, 20);
+	MD5_STEP(MD5_G, a, b, c, d, m[13], 0xa9e3e905, 5);
+	MD5_STEP(MD5_G, d, a, b, c, m[2], 0xfcefa3f8, 9);
+	MD5_STEP(MD5_G, c, d, a, b, m[7], 0x676f02d9, 14);
+	MD5_STEP(MD5_G, b, c, d, a, m[12], 0x8d2a4c8a, 20);
+
+	MD5_STEP(MD5_H, a, b, c, d, m[5], 0xfffa3942, 4);
+	MD5_STEP(MD5_H, d, a, b, c, m[8], 0x8771f681, 11);
+	MD5_STEP(MD5_H, c, d, a, b, m[11], 0x6d9d6122, 16);
+	MD5_STEP(MD5_H, b, c, d, a, m[14], 0xfde5380c, 23);
+	MD5_STEP(MD5_H, a, b, c, d, m[1], 0xa4beea44, 4);
+	MD5_STEP(MD5_H, d, a, b, c, m[4], 0x4bdecfa9, 11);
+	MD5_STEP(MD5_H, c, d, a, b, m[7], 0xf6bb4b60, 16);
+	MD5_STEP(MD5_H, b, c, d, a, m[10], 0xbebfbc70, 23);
+	MD5_STEP(MD5_H, a, b, c, d, m[13], 0x289b7ec6, 4);
+	MD5_STEP(MD5_H, d, a, b, c, m[0], 0xeaa127fa, 11);
+	MD5_STEP(MD5_H, c, d, a, b, m[3], 0xd4ef3085, 16);
+	MD5_STEP(MD5_H, b, c, d, a, m[6], 0x04881d05, 23);
+	MD5_STEP(MD5_H, a, b, c, d, m[9], 0xd9d4d039, 4);
+	MD5_STEP(MD5_H, d, a, b, c, m[12], 0xe6db99e5, 11);
+	MD5_STEP(MD5_H, c, d, a, b, m[15], 0x1fa27cf8, 16);
+	MD5_STEP(MD5_H, b, c, d, a, m[2], 0xc4ac5665, 23);
+
+	MD5_STEP(MD5_I, a, b, c, d, m[0], 0xf4292244, 6);
+	MD5_STEP(MD5_I, d, a, b, c, m[7], 0x432aff97, 10);
+	MD5_STEP(MD5_I, c, d, a, b, m[14], 0xab9423a7, 15);
+	MD5_STEP(MD5_I, b, c, d, a, m[5], 0xfc93a039, 21);
+	MD5_STEP(MD5_I, a, b, c, d, m[12], 0x655b59c3, 6);
+	MD5_STEP(MD5_I, d, a, b, c, m[3], 0x8f0ccc92, 10);
+	MD5_STEP(MD5_I, c, d, a, b, m[10], 0xffeff47d, 15);
+	MD5_STEP(MD5_I, b, c, d, a, m[1], 0x85845dd1, 21);
+	MD5_STEP(MD5_I, a, b, c, d, m[8], 0x6fa87e4f, 6);
+	MD5_STEP(MD5_I, d, a, b, c, m[15], 0xfe2ce6e0, 10);
+	MD5_STEP(MD5_I, c, d, a, b, m[6], 0xa3014314, 15);
+	MD5_STEP(MD5_I, b, c, d, a, m[13], 0x4e0811a1, 21);
+	MD5_STEP(MD5_I, a, b, c, d, m[4], 0xf7537e82, 6);
+	MD5_STEP(MD5_I, d, a, b, c, m[11], 0xbd3af235, 10);
+	MD5_STEP(MD5_I, c, d, a, b, m[2], 0x2ad7d2bb, 15);
+	MD5_STEP(MD5_I, b, c, d, a, m[9], 0xeb86d391, 21);
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+}
+
+// w is kept as a ring of 16 words
+#define SHA1_W(i) \
+	(w[(i) & 15] = Rol(w[((i) + 13) & 15] ^ w[((i) + 8) & 15] ^ w[((i) + 2) & 15] ^ w[(i) & 15], 1))
+
+#define SHA1_STEP(f, k, a, b, c, d, e, x) \
+	e += Rol(a, 5) + f(b, c, d) + (k) + (x); \
+	b = Rol(b, 30)
+
+#define SHA1_F0(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define SHA1_F1(x, y, z)	((x) ^ (y) ^ (z))
+#define SHA1_F2(x, y, z)	(((x) & (y)) | ((z) & ((x) | (y))))
+
+#define SHA1_FIVE(f, k, i, x) \
+	SHA1_STEP(f, k, a, b, c, d, e, x(i)); \
+	SHA1_STEP(f, k, e, a, b, c, d, x((i) + 1)); \
+	SHA1_STEP(f, k, d, e, a, b, c, x((i) + 2)); \
+	SHA1_STEP(f, k, c, d, e, a, b, x((i) + 3)); \
+	SHA1_STEP(f, k, b, c, d, e, a, x((i) + 4))
+
+#define SHA1_W0(i)	w[i]
+
+static VOID Sha1Block(
+	UINT* state,
+	const BYTE* lpBlock
+) {
+	UINT w[16];
+	for (INT i = 0; i < 16; i++) {
+		w[i] = LoadBe(lpBlock + i * 4);
+	}
+	UINT a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+	SHA1_FIVE(SHA1_F0, 0x5a827999, 0, SHA1_W0);
+	SHA1_FIVE(SHA1_F0, 0x5a827999, 5, SHA1_W0);
+	SHA1_FIVE(SHA1_F0, 0x5a827999, 10, SHA1_W0);
+	SHA1_STEP(SHA1_F0, 0x5a827999, a, b, c, d, e, w[15]);
+	SHA1_STEP(SHA1_F0, 0x5a827999, e, a, b, c, d, SHA1_W(16));
+	SHA1_STEP(SHA1_F0, 0x5a827999, d, e, a, b, c, SHA1_W(17));
+	SHA1_STEP(SHA1_F0, 0x5a827999, c, d, e, a, b, SHA1_W(18));
+	SHA1_STEP(SHA1_F0, 0x5a827999, b, c, d, e, a, SHA1_W(19));
+	SHA1_FIVE(SHA1_F1, 0x6ed9eba1, 20, SHA1_W);
+	SHA1_FIVE(SHA1_F1, 0x6ed9eba1, 25, SHA1_W);
+	SHA1_FIVE(SHA1_F1, 0x6ed9eba1, 30, SHA1_W);
+	SHA1_FIVE(SHA1_F1, 0x6ed9eba1, 35, SHA1_W);
+	SHA1_FIVE(SHA1_F2, 0x8f1bbcdc, 40, SHA1_W);
+	SHA1_FIVE(SHA1_F2, 0x8f1bbcdc, 45, SHA1_W);
+	SHA1_FIVE(SHA1_F2, 0x8f1bbcdc, 50, SHA1_W);
+	SHA1_FIVE(SHA1_F2, 0x8f1bbcdc, 55, SHA1_W);
+	SHA1_FIVE(SHA1_F1, 0xca62c1d6, 60, SHA1_W);
+	SHA1_FIVE(SHA1_F1, 0xca62c1d6, 65, SHA1_W);
+	SHA1_FIVE(SHA1_F1, 0xca62c1d6, 70, SHA1_W);
+	SHA1_FIVE(SHA1_F1, 0xca62c1d6, 75, SHA1_W);
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+#define SHA256_W(i) \
+	(w[(i) & 15] += (Ror(w[((i) + 14) & 15], 17) ^ Ror(w[((i) + 14) & 15], 19) ^ (w[((i) + 14) & 15] >> 10)) + \
+		w[((i) + 9) & 15] + (Ror(w[((i) + 1) & 15], 7) ^ Ror(w[((i) + 1) & 15], 18) ^ (w[((i) + 1) & 15] >> 3)))
+
+#define SHA256_STEP(a, b, c, d, e, f, g, h, k, x) { \
+	UINT t1 = h + (Ror(e, 6) ^ Ror(e, 11) ^ Ror(e, 25)) + (g ^ (e & (f ^ g))) + (k) + (x); \
+	d += t1; \
+	h = t1 + (Ror(a, 2) ^ Ror(a, 13) ^ Ror(a, 22)) + ((a & b) | (c & (a | b))); \
+}
+
+#define SHA256_EIGHT(i, x) \
+	SHA256_STEP(a, b, c, d, e, f, g, h, sha256K[i], x(i)); \
+	SHA256_STEP(h, a, b, c, d, e, f, g, sha256K[(i) + 1], x((i) + 1)); \
+	SHA256_STEP(g, h, a, b, c, d, e, f, sha256K[(i) + 2], x((i) + 2)); \
+	SHA256_STEP(f, g, h, a, b, c, d, e, sha256K[(i) + 3], x((i) + 3)); \
+	SHA256_STEP(e, f, g, h, a, b, c, d, sha256K[(i) + 4], x((i) + 4)); \
+	SHA256_STEP(d, e, f, g, h, a, b, c, sha256K[(i) + 5], x((i) + 5)); \
+	SHA256_STEP(c, d, e, f, g, h, a, b, sha256K[(i) + 6], x((i) + 6)); \
+	SHA256_STEP(b, c, d, e, f, g, h, a, sha256K[(i) + 7], x((i) + 7))
+
+#define SHA256_W0(i)	w[i]
+
+static const UINT sha256K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static VOID Sha256Block(
+	UINT* state,
+	const BYTE* lpBlock
+) {
+	UINT w[16];
+	for (INT i = 0; i < 16; i++) {
+		w[i] = LoadBe(lpBlock + i * 4);
+	}
+	UINT a = state[0], b = state[1], c = state[2], d = state[3];
+	UINT e = state[4], f = state[5], g = state[6], h = state[7];
+
+	SHA256_EIGHT(0, SHA256_W0);
+	SHA256_EIGHT(8, SHA256_W0);
+	SHA256_EIGHT(16, SHA256_W);
+	SHA256_EIGHT(24, SHA256_W);
+	SHA256_EIGHT(32, SHA256_W);
+	SHA256_EIGHT(40, SHA256_W);
+	SHA256_EIGHT(48, SHA256_W);
+	SHA256_EIGHT(56, SHA256_W);
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+static VOID BlockHashUpdate(
+	PBLOCK_HASH pHash,
+	BLOCK_FUNC func,
+	const BYTE* lpBuf,
+	size_t stSize
+) {
+	pHash->ui64Bytes += stSize;
+	if (pHash->stUsed) {
+		size_t stCopy = 64 - pHash->stUsed < stSize ? 64 - pHash->stUsed : stSize;
+		memcpy(pHash->block + pHash->stUsed, lpBuf, stCopy);
+		pHash->stUsed += stCopy;
+		lpBuf += stCopy;
+		stSize -= stCopy;
+		if (pHash->stUsed < 64) {
+			return;
+		}
+		func(pHash->state, pHash->block);
+		pHash->stUsed = 0;
+	}
+	for (; stSize >= 64; lpBuf += 64, stSize -= 64) {
+		func(pHash->state, lpBuf);
+	}
+	memcpy(pHash->block, lpBuf, stSize);
+	pHash->stUsed = stSize;
+}
+
+// Pads with the bit length (little endian for MD5, big endian otherwise)
+static VOID BlockHashFinal(
+	PBLOCK_HASH pHash,
+	BLOCK_FUNC func,
+	BOOL bBigEndian
+) {
+	UINT64 ui64Bits = pHash->ui64Bytes * 8;
+	pHash->block[pHash->stUsed++] = 0x80;
+	if (pHash->stUsed > 56) {
+		memset(pHash->block + pHash->stUsed, 0, 64 - pHash->stUsed);
+		func(pHash->state, pHash->block);
+		pHash->stUsed = 0;
+	}
+	memset(pHash->block + pHash->stUsed, 0, 56 - pHash->stUsed);
+	for (INT i = 0; i < 8; i++) {
+		pHash->block[56 + i] = (BYTE)(ui64Bits >> (bBigEndian ? 56 - i * 8 : i * 8));
+	}
+	func(pHash->state, pHash->block);
+}
+
+static VOID StoreState(
+	const BLOCK_HASH* pHash,
+	LPBYTE lpOut,
+	INT nWords,
+	BOOL bBigEndian
+) {
+	for (INT i = 0; i < nWords; i++) {
+		for (INT j = 0; j < 4; j++) {
+			lpOut[i * 4 + j] = (BYTE)(pHash->state[i] >> (bBigEndian ? 24 - j * 8 : j * 8));
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Worker
+//
+////////////////////////////////////////////////////////////////////////////////
+struct _HASH_WORKER {
+	std::thread worker;
+	std::mutex mtx;
+	std::condition_variable cvWork;
+	std::condition_variable cvDone;
+	const BYTE* lpBuf;
+	size_t stSize;
+	BOOL bBusy;
+	BOOL bStop;
+	BOOL bSha256;
+	UINT uiCrc32;
+	BLOCK_HASH md5;
+	BLOCK_HASH sha1;
+	BLOCK_HASH sha256;
+};
+
+static VOID HashBuffer(
+	PHASH_WORKER pWorker,
+	const BYTE* lpBuf,
+	size_t stSize
+) {
+	for (size_t stPos = 0; stPos < stSize; stPos += HASH_STEP_SIZE) {
+		size_t stStep = stSize - stPos < HASH_STEP_SIZE ? stSize - stPos : HASH_STEP_SIZE;
+		pWorker->uiCrc32 = Crc32Update(pWorker->uiCrc32, lpBuf + stPos, stStep);
+		BlockHashUpdate(&pWorker->md5, Md5Block, lpBuf + stPos, stStep);
+		BlockHashUpdate(&pWorker->sha1, Sha1Block, lpBuf + stPos, stStep);
+		if (pWorker->bSha256) {
+			BlockHashUpdate(&pWorker->sha256, Sha256Block, lpBuf + stPos, stStep);
+		}
+	}
+}
+
+static VOID HashWorkerLoop(
+	PHASH_WORKER pWorker
+) {
+	std::unique_lock<std::mutex> lock(pWorker->mtx);
+
+	for (;;) {
+		pWorker->cvWork.wait(lock, [pWorker] { return pWorker->bStop || pWorker->bBusy; });
+		if (!pWorker->bBusy) {
+			return;
+		}
+		const BYTE* lpBuf = pWorker->lpBuf;
+		size_t stSize = pWorker->stSize;
+
+		lock.unlock();
+		HashBuffer(pWorker, lpBuf, stSize);
+		lock.lock();
+
+		pWorker->bBusy = FALSE;
+		pWorker->cvDone.notify_one();
+	}
+}
+
+PHASH_WORKER StartHashWorker(
+	BOOL bSha256
+) {
+	static const UINT md5Init[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+	static const UINT sha1Init[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+	static const UINT sha256Init[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+	PHASH_WORKER pWorker = new HASH_WORKER();
+
+	pWorker->bSha256 = bSha256;
+	memcpy(pWorker->md5.state, md5Init, sizeof(md5Init));
+	memcpy(pWorker->sha1.state, sha1Init, sizeof(sha1Init));
+	memcpy(pWorker->sha256.state, sha256Init, sizeof(sha256Init));
+	pWorker->worker = std::thread(HashWorkerLoop, pWorker);
+	return pWorker;
+}
+
+VOID SubmitHashWorker(
+	PHASH_WORKER pWorker,
+	const BYTE* lpBuf,
+	size_t stSize
+) {
+	WaitHashWorker(pWorker);
+	{
+		std::lock_guard<std::mutex> lock(pWorker->mtx);
+		pWorker->lpBuf = lpBuf;
+		pWorker->stSize = stSize;
+		pWorker->bBusy = TRUE;
+	}
+	pWorker->cvWork.notify_one();
+}
+
+VOID WaitHashWorker(
+	PHASH_WORKER pWorker
+) {
+	std::unique_lock<std::mutex> lock(pWorker->mtx);
+	pWorker->cvDone.wait(lock, [pWorker] { return !pWorker->bBusy; });
+}
+
+VOID StopHashWorker(
+	PHASH_WORKER pWorker,
+	PHASH_DIGESTS pDigests
+) {
+	WaitHashWorker(pWorker);
+	{
+		std::lock_guard<std::mutex> lock(pWorker->mtx);
+		pWorker->bStop = TRUE;
+	}
+	pWorker->cvWork.notify_one();
+	pWorker->worker.join();
+
+	pDigests->ui64Size = pWorker->md5.ui64Bytes;
+	pDigests->uiCrc32 = pWorker->uiCrc32;
+	BlockHashFinal(&pWorker->md5, Md5Block, FALSE);
+	StoreState(&pWorker->md5, pDigests->md5, 4, FALSE);
+	BlockHashFinal(&pWorker->sha1, Sha1Block, TRUE);
+	StoreState(&pWorker->sha1, pDigests->sha1, 5, TRUE);
+	pDigests->bSha256 = pWorker->bSha256;
+	if (pWorker->bSha256) {
+		BlockHashFinal(&pWorker->sha256, Sha256Block, TRUE);
+		StoreState(&pWorker->sha256, pDigests->sha256, 8, TRUE);
+	}
+	delete pWorker;
+}
+
+VOID DigestToString(
+	const BYTE* lpDigest,
+	size_t stSize,
+	LPSTR pszOut
+) {
+	static const CHAR hex[] = "0123456789abcdef";
+	for (size_t i = 0; i < stSize; i++) {
+		pszOut[i * 2] = hex[lpDigest[i] >> 4];
+		pszOut[i * 2 + 1] = hex[lpDigest[i] & 0x0f];
+	}
+	pszOut[stSize * 2] = 0;
+}
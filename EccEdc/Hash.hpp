@@ -0,0 +1,49 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _HASH_HPP_
+#define _HASH_HPP_
+
+//
+// CRC32, MD5 and SHA-1 (and SHA-256 if asked for) of a whole file, as used by
+// redump DATs, computed on a thread of their own from the buffers the caller
+// has already read
+//
+typedef struct _HASH_WORKER HASH_WORKER, *PHASH_WORKER;
+
+typedef struct _HASH_DIGESTS {
+	UINT64 ui64Size;
+	UINT uiCrc32;
+	BYTE md5[16];
+	BYTE sha1[20];
+	BYTE sha256[32];
+	BOOL bSha256;
+} HASH_DIGESTS, *PHASH_DIGESTS;
+
+PHASH_WORKER StartHashWorker(BOOL bSha256);
+// Hashes lpBuf on the worker; it must stay readable until WaitHashWorker
+VOID SubmitHashWorker(PHASH_WORKER pWorker, const BYTE* lpBuf, size_t stSize);
+VOID WaitHashWorker(PHASH_WORKER pWorker);
+// Waits for the last buffer, then frees the worker
+VOID StopHashWorker(PHASH_WORKER pWorker, PHASH_DIGESTS pDigests);
+
+// crc32 of lpBuf, continuing from crc (0 for the first buffer)
+UINT Crc32Update(UINT crc, const BYTE* lpBuf, size_t stSize);
+
+// Lowercase hex, pszOut must hold stSize * 2 + 1 chars
+VOID DigestToString(const BYTE* lpDigest, size_t stSize, LPSTR pszOut);
+
+#endif
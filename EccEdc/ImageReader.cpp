@@ -0,0 +1,672 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/mman.h>
+#endif
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define USE_IO_URING
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+#endif
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "ImageReader.hpp"
+
+#define PAGE_TOUCH_SIZE	(4096)
+
+typedef struct _IO_SLOT {
+	PIMAGE_READER pReader;
+	UINT64 ui64Chunk;           // chunk being read into this slot
+	size_t stBytes;
+	BOOL bDone;
+} IO_SLOT, *PIO_SLOT;
+
+struct _READ_AHEAD {
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable cond;
+	size_t stChunkSize;
+	UINT uiChunks;
+	LPBYTE lpRing;              // uiChunks chunks, when not mapped
+	std::vector<size_t> chunkBytes;
+	UINT64 ui64Filled;          // chunks that are ready
+	UINT64 ui64Released;        // chunks the caller is done with
+	UINT64 ui64Current;         // chunk the caller reads from
+	size_t stOffset;
+	BOOL bStop;
+	INT nError;                 // errno of the first read that failed
+	//
+	// Reads queued on an I/O engine instead of a thread
+	//
+	PIO_ENGINE pEngine;
+	std::vector<IO_SLOT> slots;
+	UINT uiBuffer;              // index of lpRing among the engine's buffers
+	UINT64 ui64Start;           // file offset of chunk 0
+	UINT64 ui64Queued;          // chunks queued so far
+	UINT uiInFlight;
+	BOOL bEnd;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// io_uring, driven through the raw system calls
+// Both readers of a check share one ring, so the reads of the image and of
+// the .sub are in flight together; the chunk rings are registered as fixed
+// buffers when the kernel accepts it
+//
+#ifdef USE_IO_URING
+struct _IO_ENGINE {
+	INT fd;
+	UINT uiEntries;
+	LPBYTE lpSqRing;
+	size_t stSqRingSize;
+	LPBYTE lpCqRing;
+	size_t stCqRingSize;
+	struct io_uring_sqe* sqes;
+	size_t stSqesSize;
+	unsigned* sqHead;
+	unsigned* sqTail;
+	unsigned* sqMask;
+	unsigned* sqArray;
+	unsigned* cqHead;
+	unsigned* cqTail;
+	unsigned* cqMask;
+	struct io_uring_cqe* cqes;
+	UINT uiToSubmit;
+	std::vector<struct iovec> buffers;
+	size_t stRegistered;
+	BOOL bFixed;
+};
+
+PIO_ENGINE CreateIoEngine(
+	UINT uiQueueDepth
+) {
+	struct io_uring_params params = {};
+	PIO_ENGINE pEngine = new IO_ENGINE();
+	//
+	// Room for the image and the .sub each keeping uiQueueDepth reads queued
+	//
+	pEngine->fd = (INT)syscall(__NR_io_uring_setup, uiQueueDepth * 2, &params);
+	if (pEngine->fd < 0) {
+		delete pEngine;
+		return NULL;
+	}
+	pEngine->uiEntries = params.sq_entries;
+	pEngine->stSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	pEngine->stCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	pEngine->stSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	LPVOID lpSq = mmap(NULL, pEngine->stSqRingSize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, pEngine->fd, IORING_OFF_SQ_RING);
+	LPVOID lpCq = mmap(NULL, pEngine->stCqRingSize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, pEngine->fd, IORING_OFF_CQ_RING);
+	LPVOID lpSqes = mmap(NULL, pEngine->stSqesSize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, pEngine->fd, IORING_OFF_SQES);
+	if (lpSq == MAP_FAILED || lpCq == MAP_FAILED || lpSqes == MAP_FAILED) {
+		if (lpSq != MAP_FAILED) {
+			munmap(lpSq, pEngine->stSqRingSize);
+		}
+		if (lpCq != MAP_FAILED) {
+			munmap(lpCq, pEngine->stCqRingSize);
+		}
+		if (lpSqes != MAP_FAILED) {
+			munmap(lpSqes, pEngine->stSqesSize);
+		}
+		close(pEngine->fd);
+		delete pEngine;
+		return NULL;
+	}
+	pEngine->lpSqRing = (LPBYTE)lpSq;
+	pEngine->lpCqRing = (LPBYTE)lpCq;
+	pEngine->sqes = (struct io_uring_sqe*)lpSqes;
+	pEngine->sqHead = (unsigned*)(pEngine->lpSqRing + params.sq_off.head);
+	pEngine->sqTail = (unsigned*)(pEngine->lpSqRing + params.sq_off.tail);
+	pEngine->sqMask = (unsigned*)(pEngine->lpSqRing + params.sq_off.ring_mask);
+	pEngine->sqArray = (unsigned*)(pEngine->lpSqRing + params.sq_off.array);
+	pEngine->cqHead = (unsigned*)(pEngine->lpCqRing + params.cq_off.head);
+	pEngine->cqTail = (unsigned*)(pEngine->lpCqRing + params.cq_off.tail);
+	pEngine->cqMask = (unsigned*)(pEngine->lpCqRing + params.cq_off.ring_mask);
+	pEngine->cqes = (struct io_uring_cqe*)(pEngine->lpCqRing + params.cq_off.cqes);
+	return pEngine;
+}
+
+VOID DestroyIoEngine(
+	PIO_ENGINE pEngine
+) {
+	if (pEngine) {
+		munmap(pEngine->sqes, pEngine->stSqesSize);
+		munmap(pEngine->lpCqRing, pEngine->stCqRingSize);
+		munmap(pEngine->lpSqRing, pEngine->stSqRingSize);
+		close(pEngine->fd);
+		delete pEngine;
+	}
+}
+
+static UINT AddIoBuffer(
+	PIO_ENGINE pEngine,
+	LPBYTE lpBuf,
+	size_t stSize
+) {
+	struct iovec iov = { lpBuf, stSize };
+	pEngine->buffers.push_back(iov);
+	return (UINT)(pEngine->buffers.size() - 1);
+}
+
+//
+// Registers the buffers added since the last time; readers only add them
+// before their first read, while nothing of theirs is in flight
+//
+static VOID RegisterIoBuffers(
+	PIO_ENGINE pEngine
+) {
+	if (pEngine->stRegistered == pEngine->buffers.size()) {
+		return;
+	}
+	if (pEngine->stRegistered) {
+		syscall(__NR_io_uring_register, pEngine->fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+	}
+	//
+	// Fails when the buffers exceed RLIMIT_MEMLOCK; plain reads then
+	//
+	pEngine->bFixed = syscall(__NR_io_uring_register, pEngine->fd, IORING_REGISTER_BUFFERS,
+		pEngine->buffers.data(), (unsigned)pEngine->buffers.size()) == 0;
+	pEngine->stRegistered = pEngine->buffers.size();
+}
+
+static BOOL SubmitIo(
+	PIO_ENGINE pEngine,
+	UINT uiWaitFor
+) {
+	while (pEngine->uiToSubmit || uiWaitFor) {
+		INT nRet = (INT)syscall(__NR_io_uring_enter, pEngine->fd, pEngine->uiToSubmit, uiWaitFor,
+			uiWaitFor ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (nRet < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+				continue;
+			}
+			return FALSE;
+		}
+		pEngine->uiToSubmit -= (UINT)nRet;
+		uiWaitFor = 0;
+	}
+	return TRUE;
+}
+
+static VOID QueueIoRead(
+	PIO_ENGINE pEngine,
+	INT fd,
+	UINT uiBuffer,
+	LPBYTE lpBuf,
+	size_t stSize,
+	UINT64 ui64Offset,
+	PIO_SLOT pSlot
+) {
+	unsigned tail = *pEngine->sqTail;
+	if (tail - __atomic_load_n(pEngine->sqHead, __ATOMIC_ACQUIRE) == pEngine->uiEntries) {
+		SubmitIo(pEngine, 0);
+	}
+	unsigned idx = tail & *pEngine->sqMask;
+	struct io_uring_sqe* sqe = &pEngine->sqes[idx];
+	ZeroMemory(sqe, sizeof(*sqe));
+	sqe->opcode = pEngine->bFixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (UINT64)(ULONG_PTR)lpBuf;
+	sqe->len = (UINT)stSize;
+	sqe->off = ui64Offset;
+	if (pEngine->bFixed) {
+		sqe->buf_index = (UINT16)uiBuffer;
+	}
+	sqe->user_data = (UINT64)(ULONG_PTR)pSlot;
+	pEngine->sqArray[idx] = idx;
+	__atomic_store_n(pEngine->sqTail, tail + 1, __ATOMIC_RELEASE);
+	pEngine->uiToSubmit++;
+}
+
+static VOID QueueChunkRead(
+	PIMAGE_READER pReader,
+	PIO_SLOT pSlot
+) {
+	PREAD_AHEAD p = pReader->pReadAhead;
+	size_t stIdx = (size_t)(pSlot->ui64Chunk % p->uiChunks);
+	QueueIoRead(p->pEngine, fileno(pReader->fp), p->uiBuffer,
+		p->lpRing + stIdx * p->stChunkSize + pSlot->stBytes, p->stChunkSize - pSlot->stBytes,
+		p->ui64Start + pSlot->ui64Chunk * p->stChunkSize + pSlot->stBytes, pSlot);
+	p->uiInFlight++;
+}
+
+static VOID QueueChunk(
+	PIMAGE_READER pReader,
+	UINT64 ui64Chunk
+) {
+	PREAD_AHEAD p = pReader->pReadAhead;
+	PIO_SLOT pSlot = &p->slots[(size_t)(ui64Chunk % p->uiChunks)];
+	pSlot->pReader = pReader;
+	pSlot->ui64Chunk = ui64Chunk;
+	pSlot->stBytes = 0;
+	pSlot->bDone = FALSE;
+	QueueChunkRead(pReader, pSlot);
+	p->ui64Queued = ui64Chunk + 1;
+}
+
+//
+// Waits for at least one read to finish and hands every finished chunk to
+// its reader, in order
+//
+static BOOL CompleteIo(
+	PIO_ENGINE pEngine
+) {
+	if (!SubmitIo(pEngine, 1)) {
+		return FALSE;
+	}
+	unsigned head = *pEngine->cqHead;
+	while (head != __atomic_load_n(pEngine->cqTail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe* cqe = &pEngine->cqes[head & *pEngine->cqMask];
+		PIO_SLOT pSlot = (PIO_SLOT)(ULONG_PTR)cqe->user_data;
+		PREAD_AHEAD p = pSlot->pReader->pReadAhead;
+
+		p->uiInFlight--;
+		if (cqe->res > 0) {
+			pSlot->stBytes += (size_t)cqe->res;
+		}
+		else if (cqe->res < 0 && !p->nError) {
+			// the chunk ends here, like at the end of the file, but fails the read
+			p->nError = -cqe->res;
+		}
+		if (cqe->res > 0 && pSlot->stBytes < p->stChunkSize) {
+			//
+			// A short read before the end of the file; read the rest
+			//
+			QueueChunkRead(pSlot->pReader, pSlot);
+		}
+		else {
+			pSlot->bDone = TRUE;
+			for (;;) {
+				PIO_SLOT pNext = &p->slots[(size_t)(p->ui64Filled % p->uiChunks)];
+				if (!pNext->bDone || pNext->ui64Chunk != p->ui64Filled || p->ui64Filled >= p->ui64Queued) {
+					break;
+				}
+				p->chunkBytes[(size_t)(p->ui64Filled % p->uiChunks)] = pNext->stBytes;
+				if (pNext->stBytes < p->stChunkSize) {
+					p->bEnd = TRUE;
+				}
+				p->ui64Filled++;
+			}
+		}
+		head++;
+		__atomic_store_n(pEngine->cqHead, head, __ATOMIC_RELEASE);
+	}
+	return SubmitIo(pEngine, 0);
+}
+#else
+PIO_ENGINE CreateIoEngine(
+	UINT uiQueueDepth
+) {
+	UNREFERENCED_PARAMETER(uiQueueDepth);
+	return NULL;
+}
+
+VOID DestroyIoEngine(
+	PIO_ENGINE pEngine
+) {
+	UNREFERENCED_PARAMETER(pEngine);
+}
+#endif
+
+//
+// Walks the mapping ahead of the caller so that it finds the pages resident
+//
+static VOID TouchMappedChunks(
+	PIMAGE_READER pReader
+) {
+	PREAD_AHEAD p = pReader->pReadAhead;
+	UINT64 ui64Chunks = (pReader->ui64Size + p->stChunkSize - 1) / p->stChunkSize;
+	volatile BYTE bySink = 0;
+	UINT64 n = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(p->mutex);
+		n = p->ui64Released;
+	}
+	for (; n < ui64Chunks; n++) {
+		{
+			std::unique_lock<std::mutex> lock(p->mutex);
+			p->cond.wait(lock, [&] { return p->bStop || n < p->ui64Released + p->uiChunks; });
+			if (p->bStop) {
+				return;
+			}
+		}
+		UINT64 ui64End = (n + 1) * p->stChunkSize;
+		if (ui64End > pReader->ui64Size) {
+			ui64End = pReader->ui64Size;
+		}
+		for (UINT64 ui64Ofs = n * p->stChunkSize; ui64Ofs < ui64End; ui64Ofs += PAGE_TOUCH_SIZE) {
+			bySink = (BYTE)(bySink ^ pReader->lpMap[ui64Ofs]);
+		}
+	}
+}
+
+static VOID FillChunks(
+	PIMAGE_READER pReader
+) {
+	PREAD_AHEAD p = pReader->pReadAhead;
+
+	for (UINT64 n = 0;; n++) {
+		{
+			std::unique_lock<std::mutex> lock(p->mutex);
+			p->cond.wait(lock, [&] { return p->bStop || n < p->ui64Released + p->uiChunks; });
+			if (p->bStop) {
+				return;
+			}
+		}
+		size_t stIdx = (size_t)(n % p->uiChunks);
+		size_t stRead = fread(p->lpRing + stIdx * p->stChunkSize, sizeof(BYTE), p->stChunkSize, pReader->fp);
+		{
+			std::lock_guard<std::mutex> lock(p->mutex);
+			if (stRead < p->stChunkSize && ferror(pReader->fp)) {
+				p->nError = errno ? errno : EIO;
+			}
+			p->chunkBytes[stIdx] = stRead;
+			p->ui64Filled = n + 1;
+		}
+		p->cond.notify_all();
+		if (stRead < p->stChunkSize) {
+			return;
+		}
+	}
+}
+
+static BOOL GrowBuffer(
+	PIMAGE_READER pReader,
+	size_t stSize
+) {
+	if (stSize > pReader->stBufSize) {
+		LPBYTE lpBuf = (LPBYTE)realloc(pReader->lpBuf, stSize);
+		if (!lpBuf) {
+			return FALSE;
+		}
+		pReader->lpBuf = lpBuf;
+		pReader->stBufSize = stSize;
+	}
+	return TRUE;
+}
+
+//
+// Hands out the filled chunks in order; a read that crosses into the next
+// chunk is put together in the reader's own buffer
+//
+static LPBYTE ReadChunks(
+	PIMAGE_READER pReader,
+	size_t stSize,
+	size_t* pstRead
+) {
+	PREAD_AHEAD p = pReader->pReadAhead;
+	std::unique_lock<std::mutex> lock(p->mutex);
+	LPBYTE lpData = NULL;
+	size_t stCopied = 0;
+
+	auto ready = [&] {
+		return p->ui64Filled > p->ui64Current ||
+			(p->ui64Filled && p->chunkBytes[(p->ui64Filled - 1) % p->uiChunks] < p->stChunkSize);
+	};
+
+#ifdef USE_IO_URING
+	if (p->pEngine && p->ui64Queued == 0) {
+		RegisterIoBuffers(p->pEngine);
+		for (UINT64 n = 0; n < p->uiChunks; n++) {
+			QueueChunk(pReader, n);
+		}
+		if (!SubmitIo(p->pEngine, 0) && !p->nError) {
+			p->nError = errno;
+		}
+	}
+#endif
+	while (stCopied < stSize) {
+		if (p->pEngine) {
+#ifdef USE_IO_URING
+			while (!ready() && !p->nError) {
+				if (!CompleteIo(p->pEngine)) {
+					p->nError = errno;
+					break;
+				}
+			}
+#endif
+		}
+		else {
+			p->cond.wait(lock, ready);
+		}
+		if (p->ui64Filled <= p->ui64Current) {
+			break;
+		}
+		size_t stIdx = (size_t)(p->ui64Current % p->uiChunks);
+		if (p->stOffset == p->stChunkSize) {
+			//
+			// Whatever the previous call returned from this chunk is no longer
+			// in use
+			//
+			p->ui64Current++;
+			p->ui64Released = p->ui64Current;
+			p->stOffset = 0;
+			p->cond.notify_all();
+#ifdef USE_IO_URING
+			if (p->pEngine && !p->bEnd) {
+				QueueChunk(pReader, p->ui64Current - 1 + p->uiChunks);
+				if (!SubmitIo(p->pEngine, 0) && !p->nError) {
+					p->nError = errno;
+				}
+			}
+#endif
+			continue;
+		}
+		LPBYTE lpChunk = p->lpRing + stIdx * p->stChunkSize + p->stOffset;
+		size_t stAvail = p->chunkBytes[stIdx] - p->stOffset;
+		if (stAvail == 0) {
+			break;
+		}
+		if (stCopied == 0 && stAvail >= stSize) {
+			lpData = lpChunk;
+			stCopied = stSize;
+			p->stOffset += stSize;
+			break;
+		}
+		if (!GrowBuffer(pReader, stSize)) {
+			break;
+		}
+		size_t stCopy = stSize - stCopied < stAvail ? stSize - stCopied : stAvail;
+		memcpy(pReader->lpBuf + stCopied, lpChunk, stCopy);
+		stCopied += stCopy;
+		p->stOffset += stCopy;
+		lpData = pReader->lpBuf;
+	}
+	pReader->nError = p->nError;
+	*pstRead = stCopied;
+	return stCopied ? lpData : NULL;
+}
+
+static BOOL MapImage(
+	PIMAGE_READER pReader
+) {
+#ifdef _WIN32
+	HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(pReader->fp));
+	LARGE_INTEGER size = {};
+	if (hFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(hFile, &size) ||
+		size.QuadPart == 0 || (UINT64)size.QuadPart > (SIZE_T)-1) {
+		return FALSE;
+	}
+	pReader->hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!pReader->hMap) {
+		return FALSE;
+	}
+	pReader->lpMap = (LPBYTE)MapViewOfFile(pReader->hMap, FILE_MAP_READ, 0, 0, 0);
+	if (!pReader->lpMap) {
+		CloseHandle(pReader->hMap);
+		pReader->hMap = NULL;
+		return FALSE;
+	}
+	pReader->ui64Size = (UINT64)size.QuadPart;
+	pReader->ui64Pos = (UINT64)_ftelli64(pReader->fp);
+#else
+	struct stat st = {};
+	if (fstat(fileno(pReader->fp), &st) || !S_ISREG(st.st_mode) ||
+		st.st_size == 0 || (UINT64)st.st_size > (size_t)-1) {
+		return FALSE;
+	}
+	LPVOID lpMap = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fileno(pReader->fp), 0);
+	if (lpMap == MAP_FAILED) {
+		return FALSE;
+	}
+	madvise(lpMap, (size_t)st.st_size, MADV_SEQUENTIAL);
+	pReader->lpMap = (LPBYTE)lpMap;
+	pReader->ui64Size = (UINT64)st.st_size;
+	pReader->ui64Pos = (UINT64)ftello(pReader->fp);
+#endif
+	return TRUE;
+}
+
+VOID OpenImageReader(
+	PIMAGE_READER pReader,
+	FILE* fp,
+	size_t stChunkSize,
+	UINT uiChunks,
+	PIO_ENGINE pEngine
+) {
+	ZeroMemory(pReader, sizeof(IMAGE_READER));
+	pReader->fp = fp;
+	if (uiChunks == 0) {
+		pEngine = NULL;
+	}
+#ifdef USE_IO_URING
+	if (pEngine && ftello(fp) < 0) {
+		// reads through the engine are positioned, which pipes don't allow
+		pEngine = NULL;
+	}
+#endif
+	if (pEngine || !MapImage(pReader)) {
+		pReader->lpMap = NULL;
+	}
+	if (uiChunks == 0) {
+		return;
+	}
+
+	PREAD_AHEAD p = new READ_AHEAD();
+	p->stChunkSize = stChunkSize;
+	p->uiChunks = uiChunks;
+	if (!pReader->lpMap) {
+		p->chunkBytes.resize(uiChunks);
+		if (NULL == (p->lpRing = (LPBYTE)malloc(stChunkSize * uiChunks))) {
+			delete p;
+			return;
+		}
+	}
+	else {
+		p->ui64Released = pReader->ui64Pos / stChunkSize;
+	}
+	pReader->pReadAhead = p;
+#ifdef USE_IO_URING
+	if (pEngine) {
+		p->pEngine = pEngine;
+		p->slots.resize(uiChunks);
+		p->uiBuffer = AddIoBuffer(pEngine, p->lpRing, stChunkSize * uiChunks);
+		p->ui64Start = (UINT64)ftello(fp);
+		return;
+	}
+#endif
+	p->worker = std::thread(pReader->lpMap ? TouchMappedChunks : FillChunks, pReader);
+}
+
+LPBYTE ReadImage(
+	PIMAGE_READER pReader,
+	size_t stSize,
+	size_t* pstRead
+) {
+	*pstRead = 0;
+	if (pReader->lpMap) {
+		if (pReader->ui64Pos >= pReader->ui64Size) {
+			return NULL;
+		}
+		LPBYTE lpData = pReader->lpMap + pReader->ui64Pos;
+		if (stSize > pReader->ui64Size - pReader->ui64Pos) {
+			stSize = (size_t)(pReader->ui64Size - pReader->ui64Pos);
+		}
+		PREAD_AHEAD p = pReader->pReadAhead;
+		if (p) {
+			std::lock_guard<std::mutex> lock(p->mutex);
+			p->ui64Released = pReader->ui64Pos / p->stChunkSize;
+			p->cond.notify_all();
+		}
+		pReader->ui64Pos += stSize;
+		*pstRead = stSize;
+		return lpData;
+	}
+	if (pReader->pReadAhead) {
+		return ReadChunks(pReader, stSize, pstRead);
+	}
+
+	if (!GrowBuffer(pReader, stSize)) {
+		return NULL;
+	}
+	*pstRead = fread(pReader->lpBuf, sizeof(BYTE), stSize, pReader->fp);
+	if (*pstRead < stSize && ferror(pReader->fp)) {
+		pReader->nError = errno ? errno : EIO;
+	}
+	return *pstRead ? pReader->lpBuf : NULL;
+}
+
+VOID CloseImageReader(
+	PIMAGE_READER pReader
+) {
+	PREAD_AHEAD p = pReader->pReadAhead;
+	if (p) {
+		if (p->pEngine) {
+#ifdef USE_IO_URING
+			//
+			// The kernel may still be writing into the ring
+			//
+			while (p->uiInFlight && CompleteIo(p->pEngine)) {
+			}
+#endif
+		}
+		else {
+			{
+				std::lock_guard<std::mutex> lock(p->mutex);
+				p->bStop = TRUE;
+			}
+			p->cond.notify_all();
+			p->worker.join();
+		}
+		free(p->lpRing);
+		delete p;
+		pReader->pReadAhead = NULL;
+	}
+	if (pReader->lpMap) {
+#ifdef _WIN32
+		UnmapViewOfFile(pReader->lpMap);
+		CloseHandle(pReader->hMap);
+#else
+		munmap(pReader->lpMap, (size_t)pReader->ui64Size);
+#endif
+		pReader->lpMap = NULL;
+	}
+	free(pReader->lpBuf);
+	pReader->lpBuf = NULL;
+	pReader->stBufSize = 0;
+}
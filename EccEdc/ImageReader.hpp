@@ -0,0 +1,64 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _IMAGE_READER_HPP_
+#define _IMAGE_READER_HPP_
+
+//
+// Sequential reader for the image and its .sub/.toc files
+// The file is mapped whenever possible, and ReadImage then returns pointers
+// straight into the mapping; otherwise (pipes, or a failed mapping) it falls
+// back to fread into a buffer of its own
+// With read-ahead, a thread stays up to uiChunks chunks ahead of the caller:
+// it faults in the pages of a mapping, or freads into a ring of that many
+// chunk buffers, and waits whenever it gets that far ahead
+// Given an I/O engine, the chunks are read through it instead, with up to
+// uiChunks reads in flight per reader
+//
+typedef struct _READ_AHEAD READ_AHEAD, *PREAD_AHEAD;
+typedef struct _IO_ENGINE IO_ENGINE, *PIO_ENGINE;
+
+typedef struct _IMAGE_READER {
+	FILE* fp;
+	LPBYTE lpMap;     // whole file, NULL when reading through fp
+	UINT64 ui64Size;
+	UINT64 ui64Pos;
+	LPBYTE lpBuf;     // fread fallback
+	size_t stBufSize;
+	PREAD_AHEAD pReadAhead;
+	INT nError;       // errno of a failed read, which ReadImage ends at as at the end of the file
+#ifdef _WIN32
+	HANDLE hMap;
+#endif
+} IMAGE_READER, *PIMAGE_READER;
+
+// io_uring on Linux; NULL where it isn't available, and readers then work as
+// without an engine
+PIO_ENGINE CreateIoEngine(UINT uiQueueDepth);
+// After closing the readers using it
+VOID DestroyIoEngine(PIO_ENGINE pEngine);
+
+// uiChunks 0 reads on the caller's thread; otherwise use at least 2, and
+// preferably a chunk size that is a multiple of the sizes that are read
+// pEngine may be NULL
+VOID OpenImageReader(PIMAGE_READER pReader, FILE* fp, size_t stChunkSize, UINT uiChunks, PIO_ENGINE pEngine);
+// Returns stSize bytes (fewer at the end of the file, see *pstRead) from the
+// current position, valid until the next call; NULL when nothing is left
+// Check nError then, to tell the end of the file from a failed read
+LPBYTE ReadImage(PIMAGE_READER pReader, size_t stSize, size_t* pstRead);
+VOID CloseImageReader(PIMAGE_READER pReader);
+
+#endif
@@ -0,0 +1,63 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _SPSC_QUEUE_HPP_
+#define _SPSC_QUEUE_HPP_
+
+#include <atomic>
+#include <vector>
+
+//
+// Lock-free ring between exactly one pushing thread and one popping thread
+// Neither side ever waits: push fails when the ring is full, pop when it's
+// empty, and it's up to the caller what to do then
+//
+template <typename T>
+class SpscQueue {
+public:
+	explicit SpscQueue(size_t capacity)
+		: slots(capacity + 1), head(0), tail(0) {
+	}
+
+	BOOL push(const T& value) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t next = t + 1 == slots.size() ? 0 : t + 1;
+		if (next == head.load(std::memory_order_acquire)) {
+			return FALSE;
+		}
+		slots[t] = value;
+		tail.store(next, std::memory_order_release);
+		return TRUE;
+	}
+
+	BOOL pop(T& value) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) {
+			return FALSE;
+		}
+		value = slots[h];
+		head.store(h + 1 == slots.size() ? 0 : h + 1, std::memory_order_release);
+		return TRUE;
+	}
+
+private:
+	std::vector<T> slots;
+	// apart, so that the two threads don't keep taking the line from each other
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+};
+
+#endif
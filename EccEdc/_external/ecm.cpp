@@ -23,6 +23,27 @@
 #pragma GCC diagnostic ignored "-Wconversion"
 #endif
 
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define ECM_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+#endif
+
+//
+// The vector kernels are compiled for their own instruction set only, so the
+// rest of the program (e.g. the VS project built without SSE2) still runs on
+// old CPUs as long as the kernels are not selected there
+//
+#if defined(__GNUC__) || defined(__clang__)
+#define ECM_TARGET(isa) __attribute__((target(isa)))
+#else
+#define ECM_TARGET(isa)
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Sector types
@@ -87,127 +108,576 @@ static void put32lsb(uint8_t* dest, uint32_t value) {
 ////////////////////////////////////////////////////////////////////////////////
 //
 // LUTs used for computing ECC/EDC
+// All of them are generated at compile time and live in read-only data, so
+// there is nothing to set up before use and they can be shared by any thread
 //
-static uint8_t  ecc_f_lut[256];
-static uint8_t  ecc_b_lut[256];
-static uint32_t edc_lut[256];
+struct eccedc_lut_set {
+	uint8_t  ecc_f[256];
+	uint8_t  ecc_b[256];
+	uint32_t edc[256];
+	//
+	// edc_slice[n][i] is the EDC of byte i followed by n zero bytes, so 16
+	// input bytes can be folded in with 16 independent lookups (slice-by-16)
+	//
+	uint32_t edc_slice[16][256];
+	//
+	// ecc_b split by nibble for pshufb, and ecc_f/ecc_b as GF(2) bit matrices
+	// for gf2p8affineqb (both are linear maps over GF(2^8))
+	//
+	uint8_t  ecc_b_nibble[2][16];
+	uint64_t ecc_f_affine;
+	uint64_t ecc_b_affine;
+	//
+	// Q column 2j (and 2j+1 right after it) reads its k-th byte at
+	// ((j * 86) + (k * 88)) % 2236, which is 86 * ((j + k) % 26) + 2 * k
+	//
+	uint16_t ecc_q_gather[43][26];
+	//
+	// Powers and logarithms of alpha, for locating and sizing errors when
+	// correcting; ecc_exp is doubled so a sum of two logarithms needs no
+	// reduction
+	//
+	uint8_t  ecc_exp[512];
+	uint8_t  ecc_log[256];
+};
 
-void eccedc_init(void) {
-	size_t i;
-	for (i = 0; i < 256; i++) {
-		uint32_t edc = i;
-		size_t j = (i << 1) ^ (i & 0x80 ? 0x11D : 0);
-		ecc_f_lut[i] = j;
-		ecc_b_lut[i ^ j] = i;
-		for (j = 0; j < 8; j++) {
+static constexpr uint64_t ecc_affine_matrix(const uint8_t* lut) {
+	uint64_t matrix = 0;
+	for (size_t i = 0; i < 8; i++) {
+		uint64_t row = 0;
+		for (size_t j = 0; j < 8; j++) {
+			row |= (uint64_t)((lut[1 << j] >> i) & 1) << j;
+		}
+		matrix |= row << (8 * (7 - i));
+	}
+	return matrix;
+}
+
+static constexpr eccedc_lut_set eccedc_make_luts(void) {
+	eccedc_lut_set luts = {};
+	for (size_t i = 0; i < 256; i++) {
+		uint32_t edc = (uint32_t)i;
+		size_t f = (i << 1) ^ (i & 0x80 ? 0x11D : 0);
+		luts.ecc_f[i] = (uint8_t)f;
+		luts.ecc_b[i ^ f] = (uint8_t)i;
+		for (size_t j = 0; j < 8; j++) {
 			edc = (edc >> 1) ^ (edc & 1 ? 0xD8018001 : 0);
 		}
-		edc_lut[i] = edc;
+		luts.edc[i] = edc;
+	}
+	for (size_t i = 0; i < 256; i++) {
+		luts.edc_slice[0][i] = luts.edc[i];
+		for (size_t n = 1; n < 16; n++) {
+			uint32_t edc = luts.edc_slice[n - 1][i];
+			luts.edc_slice[n][i] = (edc >> 8) ^ luts.edc[edc & 0xFF];
+		}
+	}
+	for (size_t i = 0; i < 16; i++) {
+		luts.ecc_b_nibble[0][i] = luts.ecc_b[i];
+		luts.ecc_b_nibble[1][i] = luts.ecc_b[i << 4];
+	}
+	luts.ecc_f_affine = ecc_affine_matrix(luts.ecc_f);
+	luts.ecc_b_affine = ecc_affine_matrix(luts.ecc_b);
+	for (size_t i = 0; i < 43; i++) {
+		for (size_t j = 0; j < 26; j++) {
+			luts.ecc_q_gather[i][j] = (uint16_t)(86 * ((j + i) % 26) + 2 * i);
+		}
+	}
+	for (size_t i = 0, power = 1; i < 512; i++) {
+		luts.ecc_exp[i] = (uint8_t)power;
+		if (i < 255) {
+			luts.ecc_log[power] = (uint8_t)i;
+		}
+		power = luts.ecc_f[power];
+	}
+	return luts;
+}
+
+static constexpr eccedc_lut_set eccedc_luts = eccedc_make_luts();
+
+static constexpr const uint8_t  (&ecc_f_lut)[256] = eccedc_luts.ecc_f;
+static constexpr const uint8_t  (&ecc_b_lut)[256] = eccedc_luts.ecc_b;
+static constexpr const uint32_t (&edc_lut)[256] = eccedc_luts.edc;
+static constexpr const uint32_t (&edc_slice_lut)[16][256] = eccedc_luts.edc_slice;
+static constexpr const uint8_t  (&ecc_b_nibble_lut)[2][16] = eccedc_luts.ecc_b_nibble;
+static constexpr uint64_t ecc_f_affine = eccedc_luts.ecc_f_affine;
+static constexpr uint64_t ecc_b_affine = eccedc_luts.ecc_b_affine;
+static constexpr const uint16_t (&ecc_q_gather_lut)[43][26] = eccedc_luts.ecc_q_gather;
+static constexpr const uint8_t  (&ecc_exp_lut)[512] = eccedc_luts.ecc_exp;
+static constexpr const uint8_t  (&ecc_log_lut)[256] = eccedc_luts.ecc_log;
+
+//
+// Kept for callers written against the runtime-generated tables
+//
+void eccedc_init(void) {
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// CPU features used to pick the ECC/EDC kernels at runtime
+//
+static int cpu_has_sse2 = 0;
+static int cpu_has_pclmul = 0;
+static int cpu_has_ssse3 = 0;
+static int cpu_has_avx2 = 0;
+static int cpu_has_gfni = 0;
+
+static void cpu_detect(void) {
+#ifdef ECM_X86
+	unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+#ifdef _MSC_VER
+	int regs[4];
+	__cpuid(regs, 1);
+	eax = (unsigned int)regs[0];
+	ebx = (unsigned int)regs[1];
+	ecx = (unsigned int)regs[2];
+	edx = (unsigned int)regs[3];
+#else
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		return;
 	}
+#endif
+	cpu_has_sse2 = (edx >> 26) & 1;
+	cpu_has_pclmul = (ecx >> 1) & 1;
+	cpu_has_ssse3 = (ecx >> 9) & 1;
+
+	//
+	// AVX state must be enabled by the OS (OSXSAVE and XCR0 bits 1-2)
+	//
+	int avx_usable = 0;
+	if (((ecx >> 27) & 1) && ((ecx >> 28) & 1)) {
+#ifdef _MSC_VER
+		avx_usable = (_xgetbv(0) & 6) == 6;
+#else
+		unsigned int xcr0_lo = 0, xcr0_hi = 0;
+		__asm__ __volatile__(".byte 0x0f, 0x01, 0xd0" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+		avx_usable = (xcr0_lo & 6) == 6;
+#endif
+	}
+#ifdef _MSC_VER
+	__cpuid(regs, 0);
+	if (regs[0] < 7) {
+		return;
+	}
+	__cpuidex(regs, 7, 0);
+	ebx = (unsigned int)regs[1];
+	ecx = (unsigned int)regs[2];
+#else
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+		return;
+	}
+#endif
+	cpu_has_avx2 = avx_usable && ((ebx >> 5) & 1);
+	cpu_has_gfni = (ecx >> 8) & 1;
+#endif
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Compute EDC for a block
 //
-static uint32_t edc_compute(
+static uint32_t edc_compute_lut(
 	uint32_t edc,
 	const uint8_t* src,
 	size_t size
 ) {
+	//
+	// Slice-by-16: 16 bytes per iteration
+	//
+	for (; size >= 16; size -= 16, src += 16) {
+		uint32_t w0 = edc ^ get32lsb(src);
+		uint32_t w1 = get32lsb(src + 4);
+		uint32_t w2 = get32lsb(src + 8);
+		uint32_t w3 = get32lsb(src + 12);
+		edc =
+			edc_slice_lut[15][w0 & 0xFF] ^ edc_slice_lut[14][(w0 >> 8) & 0xFF] ^
+			edc_slice_lut[13][(w0 >> 16) & 0xFF] ^ edc_slice_lut[12][w0 >> 24] ^
+			edc_slice_lut[11][w1 & 0xFF] ^ edc_slice_lut[10][(w1 >> 8) & 0xFF] ^
+			edc_slice_lut[9][(w1 >> 16) & 0xFF] ^ edc_slice_lut[8][w1 >> 24] ^
+			edc_slice_lut[7][w2 & 0xFF] ^ edc_slice_lut[6][(w2 >> 8) & 0xFF] ^
+			edc_slice_lut[5][(w2 >> 16) & 0xFF] ^ edc_slice_lut[4][w2 >> 24] ^
+			edc_slice_lut[3][w3 & 0xFF] ^ edc_slice_lut[2][(w3 >> 8) & 0xFF] ^
+			edc_slice_lut[1][(w3 >> 16) & 0xFF] ^ edc_slice_lut[0][w3 >> 24];
+	}
+	//
+	// Remaining bytes
+	//
 	for (; size; size--) {
 		edc = (edc >> 8) ^ edc_lut[(edc ^ (*src++)) & 0xFF];
 	}
 	return edc;
 }
 
+#ifdef ECM_X86
+//
+// Carry-less multiplication folding, 64 bytes per iteration
+// The constants are x^(n+32) mod P and x^(n-32) mod P, bit-reflected and
+// shifted left by one, for the EDC polynomial and a fold distance of n bits
+//
+ECM_TARGET("sse2,pclmul")
+static __m128i edc_fold(
+	__m128i x,
+	__m128i k
+) {
+	return _mm_xor_si128(
+		_mm_clmulepi64_si128(x, k, 0x00),
+		_mm_clmulepi64_si128(x, k, 0x11));
+}
+
+ECM_TARGET("sse2,pclmul")
+static uint32_t edc_compute_clmul(
+	uint32_t edc,
+	const uint8_t* src,
+	size_t size
+) {
+	if (size < 64) {
+		return edc_compute_lut(edc, src, size);
+	}
+	const __m128i k512 = _mm_set_epi32(0x00000001, 0x2E7928A2, 0x00000001, 0xF8931102);
+	const __m128i k128 = _mm_set_epi32(0x00000001, 0xD5934102, 0x00000000, 0x6C90C100);
+	__m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + 0x00)), _mm_cvtsi32_si128((int)edc));
+	__m128i x1 = _mm_loadu_si128((const __m128i*)(src + 0x10));
+	__m128i x2 = _mm_loadu_si128((const __m128i*)(src + 0x20));
+	__m128i x3 = _mm_loadu_si128((const __m128i*)(src + 0x30));
+	src += 64;
+	size -= 64;
+	for (; size >= 64; size -= 64, src += 64) {
+		x0 = _mm_xor_si128(edc_fold(x0, k512), _mm_loadu_si128((const __m128i*)(src + 0x00)));
+		x1 = _mm_xor_si128(edc_fold(x1, k512), _mm_loadu_si128((const __m128i*)(src + 0x10)));
+		x2 = _mm_xor_si128(edc_fold(x2, k512), _mm_loadu_si128((const __m128i*)(src + 0x20)));
+		x3 = _mm_xor_si128(edc_fold(x3, k512), _mm_loadu_si128((const __m128i*)(src + 0x30)));
+	}
+	x0 = _mm_xor_si128(edc_fold(x0, k128), x1);
+	x0 = _mm_xor_si128(edc_fold(x0, k128), x2);
+	x0 = _mm_xor_si128(edc_fold(x0, k128), x3);
+	for (; size >= 16; size -= 16, src += 16) {
+		x0 = _mm_xor_si128(edc_fold(x0, k128), _mm_loadu_si128((const __m128i*)src));
+	}
+	//
+	// The folded 128 bits have the same EDC as the data they replace
+	//
+	uint8_t folded[16];
+	_mm_storeu_si128((__m128i*)folded, x0);
+	edc = edc_compute_lut(0, folded, sizeof(folded));
+	return edc_compute_lut(edc, src, size);
+}
+#endif
+
+static uint32_t (*edc_compute_func)(uint32_t, const uint8_t*, size_t) = edc_compute_lut;
+
+static uint32_t edc_compute(
+	uint32_t edc,
+	const uint8_t* src,
+	size_t size
+) {
+	return edc_compute_func(edc, src, size);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Check ECC block (either P or Q)
-// Returns true if the ECC data is an exact match
+// Codeword of a sector as the P/Q routines index it: address then data
+// (the Q code also covers the P parity, which follows the data)
 //
-static int8_t ecc_checkpq(
+#define ECC_CODEWORD_SIZE (4 + 0x80C + 0xAC)
+
+static void ecc_load_codeword(
 	const uint8_t* address,
 	const uint8_t* data,
-	size_t major_count,
-	size_t minor_count,
-	size_t major_mult,
-	size_t minor_inc,
-	const uint8_t* ecc
+	uint8_t* codeword
 ) {
+	memcpy(codeword, address, 4);
+	memcpy(codeword + 4, data, ECC_CODEWORD_SIZE - 4);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ECC block (either P or Q) with its geometry fixed at compile time
+// index_lut.index[major][minor] is the codeword offset of each byte of a
+// column, i.e. ((major / 2) * major_mult + (major % 2) + minor * minor_inc)
+// % size, so the column walk is a plain table gather into the codeword
+//
+template <size_t major_count, size_t minor_count>
+struct ecc_pq_index_lut {
+	uint16_t index[major_count][minor_count];
+};
+
+template <size_t major_count, size_t minor_count, size_t major_mult, size_t minor_inc>
+static constexpr ecc_pq_index_lut<major_count, minor_count> ecc_pq_make_index_lut(void) {
+	ecc_pq_index_lut<major_count, minor_count> lut = {};
 	size_t size = major_count * minor_count;
-	size_t major;
-	for (major = 0; major < major_count; major++) {
+	for (size_t major = 0; major < major_count; major++) {
 		size_t index = (major >> 1) * major_mult + (major & 1);
-		uint8_t ecc_a = 0;
-		uint8_t ecc_b = 0;
-		size_t minor;
-		for (minor = 0; minor < minor_count; minor++) {
-			uint8_t temp;
-			if (index < 4) {
-				temp = address[index];
-			} else {
-				temp = data[index - 4];
-			}
+		for (size_t minor = 0; minor < minor_count; minor++) {
+			lut.index[major][minor] = (uint16_t)index;
 			index += minor_inc;
 			if (index >= size) {
 				index -= size;
 			}
-			ecc_a ^= temp;
-			ecc_b ^= temp;
-			ecc_a = ecc_f_lut[ecc_a];
-		}
-		ecc_a = ecc_b_lut[ecc_f_lut[ecc_a] ^ ecc_b];
-		if (
-			ecc[major] != (ecc_a) ||
-			ecc[major + major_count] != (ecc_a ^ ecc_b)
-			) {
-			return 0;
 		}
 	}
-	return 1;
+	return lut;
 }
 
-//
-// Write ECC block (either P or Q)
-//
-static void ecc_writepq(
-	const uint8_t* address,
-	const uint8_t* data,
-	size_t major_count,
-	size_t minor_count,
-	size_t major_mult,
-	size_t minor_inc,
-	uint8_t* ecc
-) {
-	size_t size = major_count * minor_count;
-	size_t major;
-	for (major = 0; major < major_count; major++) {
-		size_t index = (major >> 1) * major_mult + (major & 1);
+template <size_t major_count, size_t minor_count, size_t major_mult, size_t minor_inc>
+struct ecc_pq {
+	static constexpr ecc_pq_index_lut<major_count, minor_count> index_lut =
+		ecc_pq_make_index_lut<major_count, minor_count, major_mult, minor_inc>();
+
+	static void compute(
+		const uint8_t* codeword,
+		size_t major,
+		uint8_t* ecc_a_out,
+		uint8_t* ecc_b_out
+	) {
+		const uint16_t* index = index_lut.index[major];
 		uint8_t ecc_a = 0;
 		uint8_t ecc_b = 0;
 		size_t minor;
 		for (minor = 0; minor < minor_count; minor++) {
-			uint8_t temp;
-			if (index < 4) {
-				temp = address[index];
-			} else {
-				temp = data[index - 4];
-			}
-			index += minor_inc;
-			if (index >= size) {
-				index -= size;
-			}
+			uint8_t temp = codeword[index[minor]];
 			ecc_a ^= temp;
 			ecc_b ^= temp;
 			ecc_a = ecc_f_lut[ecc_a];
 		}
 		ecc_a = ecc_b_lut[ecc_f_lut[ecc_a] ^ ecc_b];
-		ecc[major] = (ecc_a);
-		ecc[major + major_count] = (ecc_a ^ ecc_b);
+		*ecc_a_out = ecc_a;
+		*ecc_b_out = ecc_a ^ ecc_b;
+	}
+
+	//
+	// Check ECC block
+	// Returns true if the ECC data is an exact match
+	//
+	static int8_t check(
+		const uint8_t* codeword,
+		const uint8_t* ecc
+	) {
+		size_t major;
+		for (major = 0; major < major_count; major++) {
+			uint8_t ecc_a, ecc_b;
+			compute(codeword, major, &ecc_a, &ecc_b);
+			if (
+				ecc[major] != ecc_a ||
+				ecc[major + major_count] != ecc_b
+				) {
+				return 0;
+			}
+		}
+		return 1;
+	}
+
+	//
+	// Write ECC block
+	//
+	static void write(
+		const uint8_t* codeword,
+		uint8_t* ecc
+	) {
+		size_t major;
+		for (major = 0; major < major_count; major++) {
+			compute(codeword, major, &ecc[major], &ecc[major + major_count]);
+		}
+	}
+};
+
+template <size_t major_count, size_t minor_count, size_t major_mult, size_t minor_inc>
+constexpr ecc_pq_index_lut<major_count, minor_count>
+ecc_pq<major_count, minor_count, major_mult, minor_inc>::index_lut;
+
+typedef ecc_pq<86, 24, 2, 86> ecc_p;
+typedef ecc_pq<52, 43, 86, 88> ecc_q;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Vectorized ECC P/Q kernels
+//
+// The input is laid out as rows of lanes: row k holds the k-th byte of every
+// P or Q column, so all columns are computed at once. Each kernel produces
+// the two parity bytes of every lane, exactly as ecc_writepq does per column.
+// ecc_f_lut is a multiply by alpha (x << 1, reduced by 0x11D), ecc_b_lut is
+// done with two 16-entry pshufb lookups or a single gf2p8affineqb.
+//
+#define ECC_P_LANES 96
+#define ECC_Q_LANES 64
+
+typedef void (*ecc_pq_kernel)(
+	const uint8_t* rows,
+	size_t row_count,
+	size_t row_stride,
+	size_t lanes,
+	uint8_t* ecc_p0,
+	uint8_t* ecc_p1
+);
+
+static ecc_pq_kernel ecc_pq_func = NULL;
+
+#ifdef ECM_X86
+ECM_TARGET("ssse3")
+static __m128i ecc_mul_f_ssse3(
+	__m128i x
+) {
+	const __m128i poly = _mm_set1_epi8(0x1D);
+	return _mm_xor_si128(_mm_add_epi8(x, x), _mm_and_si128(_mm_cmpgt_epi8(_mm_setzero_si128(), x), poly));
+}
+
+ECM_TARGET("ssse3")
+static void ecc_pq_ssse3(
+	const uint8_t* rows,
+	size_t row_count,
+	size_t row_stride,
+	size_t lanes,
+	uint8_t* ecc_p0,
+	uint8_t* ecc_p1
+) {
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	const __m128i b_lo = _mm_loadu_si128((const __m128i*)ecc_b_nibble_lut[0]);
+	const __m128i b_hi = _mm_loadu_si128((const __m128i*)ecc_b_nibble_lut[1]);
+	size_t lane;
+	for (lane = 0; lane < lanes; lane += 16) {
+		const uint8_t* row = rows + lane;
+		__m128i ecc_a = _mm_setzero_si128();
+		__m128i ecc_b = _mm_setzero_si128();
+		size_t k;
+		for (k = 0; k < row_count; k++, row += row_stride) {
+			__m128i temp = _mm_loadu_si128((const __m128i*)row);
+			ecc_a = ecc_mul_f_ssse3(_mm_xor_si128(ecc_a, temp));
+			ecc_b = _mm_xor_si128(ecc_b, temp);
+		}
+		ecc_a = _mm_xor_si128(ecc_mul_f_ssse3(ecc_a), ecc_b);
+		ecc_a = _mm_xor_si128(
+			_mm_shuffle_epi8(b_lo, _mm_and_si128(ecc_a, nibble)),
+			_mm_shuffle_epi8(b_hi, _mm_and_si128(_mm_srli_epi16(ecc_a, 4), nibble)));
+		_mm_storeu_si128((__m128i*)(ecc_p0 + lane), ecc_a);
+		_mm_storeu_si128((__m128i*)(ecc_p1 + lane), _mm_xor_si128(ecc_a, ecc_b));
 	}
 }
 
+ECM_TARGET("avx2")
+static __m256i ecc_mul_f_avx2(
+	__m256i x
+) {
+	const __m256i poly = _mm256_set1_epi8(0x1D);
+	return _mm256_xor_si256(_mm256_add_epi8(x, x), _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_setzero_si256(), x), poly));
+}
+
+ECM_TARGET("avx2")
+static void ecc_pq_avx2(
+	const uint8_t* rows,
+	size_t row_count,
+	size_t row_stride,
+	size_t lanes,
+	uint8_t* ecc_p0,
+	uint8_t* ecc_p1
+) {
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
+	const __m256i b_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)ecc_b_nibble_lut[0]));
+	const __m256i b_hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)ecc_b_nibble_lut[1]));
+	size_t lane;
+	for (lane = 0; lane < lanes; lane += 32) {
+		const uint8_t* row = rows + lane;
+		__m256i ecc_a = _mm256_setzero_si256();
+		__m256i ecc_b = _mm256_setzero_si256();
+		size_t k;
+		for (k = 0; k < row_count; k++, row += row_stride) {
+			__m256i temp = _mm256_loadu_si256((const __m256i*)row);
+			ecc_a = ecc_mul_f_avx2(_mm256_xor_si256(ecc_a, temp));
+			ecc_b = _mm256_xor_si256(ecc_b, temp);
+		}
+		ecc_a = _mm256_xor_si256(ecc_mul_f_avx2(ecc_a), ecc_b);
+		ecc_a = _mm256_xor_si256(
+			_mm256_shuffle_epi8(b_lo, _mm256_and_si256(ecc_a, nibble)),
+			_mm256_shuffle_epi8(b_hi, _mm256_and_si256(_mm256_srli_epi16(ecc_a, 4), nibble)));
+		_mm256_storeu_si256((__m256i*)(ecc_p0 + lane), ecc_a);
+		_mm256_storeu_si256((__m256i*)(ecc_p1 + lane), _mm256_xor_si256(ecc_a, ecc_b));
+	}
+}
+
+ECM_TARGET("avx2,gfni")
+static void ecc_pq_gfni(
+	const uint8_t* rows,
+	size_t row_count,
+	size_t row_stride,
+	size_t lanes,
+	uint8_t* ecc_p0,
+	uint8_t* ecc_p1
+) {
+	const __m256i f_matrix = _mm256_set1_epi64x((long long)ecc_f_affine);
+	const __m256i b_matrix = _mm256_set1_epi64x((long long)ecc_b_affine);
+	size_t lane;
+	for (lane = 0; lane < lanes; lane += 32) {
+		const uint8_t* row = rows + lane;
+		__m256i ecc_a = _mm256_setzero_si256();
+		__m256i ecc_b = _mm256_setzero_si256();
+		size_t k;
+		for (k = 0; k < row_count; k++, row += row_stride) {
+			__m256i temp = _mm256_loadu_si256((const __m256i*)row);
+			ecc_a = _mm256_gf2p8affine_epi64_epi8(_mm256_xor_si256(ecc_a, temp), f_matrix, 0);
+			ecc_b = _mm256_xor_si256(ecc_b, temp);
+		}
+		ecc_a = _mm256_xor_si256(_mm256_gf2p8affine_epi64_epi8(ecc_a, f_matrix, 0), ecc_b);
+		ecc_a = _mm256_gf2p8affine_epi64_epi8(ecc_a, b_matrix, 0);
+		_mm256_storeu_si256((__m256i*)(ecc_p0 + lane), ecc_a);
+		_mm256_storeu_si256((__m256i*)(ecc_p1 + lane), _mm256_xor_si256(ecc_a, ecc_b));
+	}
+}
+#endif
+
+//
+// Gather the Q diagonals into rows: byte pair j of row k is the k-th pair of
+// Q columns 2j and 2j+1 (see ecc_q_gather_lut)
+//
+static void ecc_gather_q(
+	const uint8_t* codeword,
+	uint8_t (*q_rows)[ECC_Q_LANES]
+) {
+	const uint16_t* offset = ecc_q_gather_lut[0];
+	size_t k;
+	for (k = 0; k < 43; k++) {
+		size_t j;
+		for (j = 0; j < 26; j++) {
+			memcpy(&q_rows[k][2 * j], codeword + *offset++, 2);
+		}
+	}
+}
+
+static int8_t ecc_checksector_vec(
+	const uint8_t *codeword,
+	const uint8_t *ecc
+) {
+	uint8_t q_rows[43][ECC_Q_LANES] = {};
+	uint8_t ecc_p0[ECC_P_LANES];
+	uint8_t ecc_p1[ECC_P_LANES];
+
+	ecc_pq_func(codeword, 24, 86, ECC_P_LANES, ecc_p0, ecc_p1);
+	if (memcmp(ecc, ecc_p0, 86) || memcmp(ecc + 86, ecc_p1, 86)) {
+		return 0;
+	}
+	ecc_gather_q(codeword, q_rows);
+	ecc_pq_func(q_rows[0], 43, ECC_Q_LANES, ECC_Q_LANES, ecc_p0, ecc_p1);
+	if (memcmp(ecc + 0xAC, ecc_p0, 52) || memcmp(ecc + 0xAC + 52, ecc_p1, 52)) {
+		return 0;
+	}
+	return 1;
+}
+
+static void ecc_writesector_vec(
+	uint8_t *codeword,
+	uint8_t *ecc
+) {
+	uint8_t q_rows[43][ECC_Q_LANES] = {};
+	uint8_t ecc_p0[ECC_P_LANES];
+	uint8_t ecc_p1[ECC_P_LANES];
+
+	ecc_pq_func(codeword, 24, 86, ECC_P_LANES, ecc_p0, ecc_p1);
+	memcpy(ecc, ecc_p0, 86);
+	memcpy(ecc + 86, ecc_p1, 86);
+	memcpy(codeword + 4 + 0x80C, ecc, 0xAC);
+	ecc_gather_q(codeword, q_rows);
+	ecc_pq_func(q_rows[0], 43, ECC_Q_LANES, ECC_Q_LANES, ecc_p0, ecc_p1);
+	memcpy(ecc + 0xAC, ecc_p0, 52);
+	memcpy(ecc + 0xAC + 52, ecc_p1, 52);
+}
+
 //
 // Check ECC P and Q codes for a sector
 // Returns true if the ECC data is an exact match
@@ -217,9 +687,15 @@ static int8_t ecc_checksector(
 	const uint8_t *data,
 	const uint8_t *ecc
 ) {
+	// the vector kernels read up to a full vector past the last P row
+	uint8_t codeword[ECC_CODEWORD_SIZE + ECC_P_LANES];
+	ecc_load_codeword(address, data, codeword);
+	if (ecc_pq_func) {
+		return ecc_checksector_vec(codeword, ecc);
+	}
 	return
-		ecc_checkpq(address, data, 86, 24, 2, 86, ecc) &&       // P
-		ecc_checkpq(address, data, 52, 43, 86, 88, ecc + 0xAC); // Q
+		ecc_p::check(codeword, ecc) &&       // P
+		ecc_q::check(codeword, ecc + 0xAC);  // Q
 }
 
 //
@@ -230,13 +706,199 @@ static void ecc_writesector(
 	const uint8_t *data,
 	uint8_t *ecc
 ) {
-	ecc_writepq(address, data, 86, 24, 2, 86, ecc);         // P
-	ecc_writepq(address, data, 52, 43, 86, 88, ecc + 0xAC); // Q
+	uint8_t codeword[ECC_CODEWORD_SIZE + ECC_P_LANES];
+	ecc_load_codeword(address, data, codeword);
+	if (ecc_pq_func) {
+		ecc_writesector_vec(codeword, ecc);
+		return;
+	}
+	ecc_p::write(codeword, ecc);         // P
+	//
+	// Q covers the P parity just written
+	//
+	memcpy(codeword + 4 + 0x80C, ecc, 0xAC);
+	ecc_q::write(codeword, ecc + 0xAC);  // Q
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Syndrome check
+//
+// A P or Q column is a codeword of a (n, n - 2) Reed-Solomon code: it is
+// intact exactly when both syndromes, the plain sum of its bytes and their sum
+// weighted by alpha^(n - 1 - position), are zero. The kernels compute those
+// two sums on their way to the parity, and the parity they return is zero
+// exactly when both sums are, so running them over a column including its
+// own parity checks it without regenerating and comparing anything.
+//
+// For Q, with its parity appended to each row as byte pairs 43 and 44, row r
+// holds byte pair k of Q column pair (r - k) mod 26. Row i of the Q syndrome
+// pass takes byte pairs i - 25 ... i of row i mod 26, so lane pair 25 - j
+// walks Q column pair j in order of k: the rows are plain (shifted) copies
+// instead of a two byte gather per element.
+//
+#define ECC_Q_SYNDROME_ROWS   70
+#define ECC_Q_SYNDROME_STRIDE 240
+#define ECC_Q_SYNDROME_LANE0  88
+
+//
+// Returns true if all P and Q syndromes are zero, which is the case exactly
+// when ecc_checksector matches
+// data must be followed by the P and Q parity, as in a sector
+// Needs a vector kernel: table-driven, the two passes cost more than
+// ecc_checksector
+//
+static int8_t ecc_checksector_syndrome(
+	const uint8_t *address,
+	const uint8_t *data
+) {
+	//
+	// Each row always lands at the same place, so the zeros around it are
+	// only written once per thread
+	//
+	static thread_local uint8_t q_rows[ECC_Q_SYNDROME_ROWS][ECC_Q_SYNDROME_STRIDE];
+	ecc_pq_kernel kernel = ecc_pq_func;
+	uint8_t codeword[ECC_CODEWORD_SIZE + ECC_P_LANES];
+	uint8_t ecc_p0[ECC_P_LANES];
+	uint8_t ecc_p1[ECC_P_LANES];
+	const uint8_t* ecc_q = data + 0x80C + 0xAC;
+	size_t i;
+
+	//
+	// Copied row by row: a single copy of this size tends to be expanded to
+	// a rep movs, which is slow to start
+	//
+	memcpy(codeword, address, 4);
+	memcpy(codeword + 4, data, 82);
+	for (i = 1; i < 26; i++) {
+		memcpy(codeword + 86 * i, data - 4 + 86 * i, 86);
+	}
+	memset(codeword + ECC_CODEWORD_SIZE, 0, ECC_P_LANES);
+
+	kernel(codeword, 26, 86, ECC_P_LANES, ecc_p0, ecc_p1);
+	for (i = 0; i < 86; i++) {
+		if (ecc_p0[i] | ecc_p1[i]) {
+			return 0;
+		}
+	}
+
+	for (i = 0; i < ECC_Q_SYNDROME_ROWS; i++) {
+		size_t r = i % 26;
+		uint8_t* row = q_rows[i] + ECC_Q_SYNDROME_LANE0 + 50 - 2 * i;
+		memcpy(row, codeword + 86 * r, 86);
+		memcpy(row + 86, ecc_q + 2 * ((r + 9) % 26), 2);
+		memcpy(row + 88, ecc_q + 52 + 2 * ((r + 8) % 26), 2);
+	}
+	kernel(q_rows[0] + ECC_Q_SYNDROME_LANE0, ECC_Q_SYNDROME_ROWS, ECC_Q_SYNDROME_STRIDE,
+		ECC_Q_LANES, ecc_p0, ecc_p1);
+	for (i = 0; i < 52; i++) {
+		if (ecc_p0[i] | ecc_p1[i]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Pick the fastest EDC and ECC kernels for this CPU
+// The table-driven code is the reference and the fallback
+//
+static void eccedc_select(void) {
+	cpu_detect();
+	edc_compute_func = edc_compute_lut;
+	ecc_pq_func = NULL;
+#ifdef ECM_X86
+	if (cpu_has_sse2 && cpu_has_pclmul) {
+		edc_compute_func = edc_compute_clmul;
+	}
+	if (cpu_has_avx2 && cpu_has_gfni) {
+		ecc_pq_func = ecc_pq_gfni;
+	}
+	else if (cpu_has_avx2) {
+		ecc_pq_func = ecc_pq_avx2;
+	}
+	else if (cpu_has_ssse3) {
+		ecc_pq_func = ecc_pq_ssse3;
+	}
+#endif
+}
+
+//
+// The kernels are picked while the module is loaded, before any caller can
+// reach them; until then the table-driven fallbacks above are in place
+//
+static const struct eccedc_selector {
+	eccedc_selector() {
+		eccedc_select();
+	}
+} eccedc_selector_s;
+
 ////////////////////////////////////////////////////////////////////////////////
 
 static const uint8_t zeroaddress[4] = { 0, 0, 0, 0 };
+static const uint8_t syncpattern[12] = {
+	0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// EDC/ECC results the sector classification depends on, computed on first
+// use and cheapest first: ECC is only checked once the EDC matched, since a
+// sector with a bad EDC fails either way
+//
+#define SECTOR_CHECK_PENDING (-1)
+
+typedef struct _sector_checks {
+	int8_t ecc;       // ECC of Mode 1, or Mode 2 Form 1
+	int8_t edc;       // EDC of Mode 1, or Mode 2 Form 1
+	int8_t edc_form2; // EDC of Mode 2 Form 2
+	uint32_t edc_mode2_form1; // EDC of Mode 2 up to 0x818, once edc is known
+} sector_checks;
+
+static int8_t sector_check_ecc(const uint8_t* sector, sector_checks* checks) {
+	if (checks->ecc == SECTOR_CHECK_PENDING) {
+		//
+		// The syndromes settle the common case; a sector that fails them
+		// still goes through the regenerate-and-compare check
+		//
+		const uint8_t* address = (sector[0x00F] & 0x0f) == 0x01 ? sector + 0xC : zeroaddress;
+		if (ecc_pq_func && ecc_checksector_syndrome(address, sector + 0x10)) {
+			checks->ecc = 1;
+		}
+		else {
+			checks->ecc = ecc_checksector(address, sector + 0x10, sector + 0x81C);
+		}
+	}
+	return checks->ecc;
+}
+
+static int8_t sector_check_edc(const uint8_t* sector, sector_checks* checks) {
+	if (checks->edc == SECTOR_CHECK_PENDING) {
+		if ((sector[0x00F] & 0x0f) == 0x01) {
+			checks->edc = edc_compute(0, sector, 0x810) == get32lsb(sector + 0x810);
+		}
+		else {
+			checks->edc_mode2_form1 = edc_compute(0, sector + 0x10, 0x808);
+			checks->edc = checks->edc_mode2_form1 == get32lsb(sector + 0x10 + 0x808);
+		}
+	}
+	return checks->edc;
+}
+
+//
+// Both forms cover the data from 0x10, so the Form 2 EDC continues from the
+// Form 1 one instead of starting over
+//
+static int8_t sector_check_edc_form2(const uint8_t* sector, sector_checks* checks) {
+	if (checks->edc_form2 == SECTOR_CHECK_PENDING) {
+		uint32_t edc;
+		sector_check_edc(sector, checks);
+		edc = edc_compute(checks->edc_mode2_form1, sector + 0x10 + 0x808, 0x91C - 0x808);
+		checks->edc_form2 = edc == get32lsb(sector + 0x10 + 0x91C);
+	}
+	return checks->edc_form2;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -248,7 +910,12 @@ static const uint8_t zeroaddress[4] = { 0, 0, 0, 0 };
 //   2: 2336 mode 2 form 1  predict redundant flags, edc, ecc
 //   3: 2336 mode 2 form 2  predict redundant flags, edc
 //
-SectorType detect_sector(const uint8_t* sector, size_t size_available, TrackMode *trackMode) {
+static SectorType detect_sector_checked(
+	const uint8_t* sector,
+	size_t size_available,
+	TrackMode *trackMode,
+	sector_checks* checks
+) {
 	if (size_available >= 2352) {
 		if (sector[0x000] == 0x00 && sector[0x001] == 0xFF && sector[0x002] == 0xFF && sector[0x003] == 0xFF &&
 			sector[0x004] == 0xFF && sector[0x005] == 0xFF && sector[0x006] == 0xFF && sector[0x007] == 0xFF &&
@@ -282,8 +949,7 @@ SectorType detect_sector(const uint8_t* sector, size_t size_available, TrackMode
 				if (trackMode) {
 					*trackMode = TrackMode1;
 				}
-				if (ecc_checksector(sector + 0xC, sector + 0x10, sector + 0x81C) &&
-					edc_compute(0, sector, 0x810) == get32lsb(sector + 0x810)) {
+				if (sector_check_edc(sector, checks) && sector_check_ecc(sector, checks)) {
 					if (sector[0x814] == 0x00 && sector[0x815] == 0x00 && sector[0x816] == 0x00 && sector[0x817] == 0x00 &&
 						sector[0x818] == 0x00 && sector[0x819] == 0x00 && sector[0x81A] == 0x00 && sector[0x81B] == 0x00) { // reserved (8 bytes)
 						//
@@ -314,8 +980,7 @@ SectorType detect_sector(const uint8_t* sector, size_t size_available, TrackMode
 				//
 				// Might be Mode 2, Form 1
 				//
-				if (ecc_checksector(zeroaddress, sector + 0x10, sector + 0x10 + 0x80C) &&
-					edc_compute(0, sector + 0x10, 0x808) == get32lsb(sector + 0x10 + 0x808)) {
+				if (sector_check_edc(sector, checks) && sector_check_ecc(sector, checks)) {
 					if (sector[0x10] == sector[0x14] && sector[0x11] == sector[0x15] &&
 						sector[0x12] == sector[0x16] && sector[0x13] == sector[0x17]) { // flags (4 bytes) versus redundant copy
 						if (sector[0x00F] == 0x02) {
@@ -335,7 +1000,7 @@ SectorType detect_sector(const uint8_t* sector, size_t size_available, TrackMode
 				//
 				// Might be Mode 2, Form 2
 				//
-				else if (edc_compute(0, sector + 0x10, 0x91C) == get32lsb(sector + 0x10 + 0x91C)) {
+				else if (sector_check_edc_form2(sector, checks)) {
 					if (sector[0x10] == sector[0x14] && sector[0x11] == sector[0x15] &&
 						sector[0x12] == sector[0x16] && sector[0x13] == sector[0x17]) { // flags (4 bytes) versus redundant copy
 						if (sector[0x00F] == 0x02) {
@@ -394,6 +1059,29 @@ SectorType detect_sector(const uint8_t* sector, size_t size_available, TrackMode
 	return Nothing;
 }
 
+SectorType detect_sector(const uint8_t* sector, size_t size_available, TrackMode *trackMode) {
+	sector_checks checks = { SECTOR_CHECK_PENDING, SECTOR_CHECK_PENDING, SECTOR_CHECK_PENDING, 0 };
+	return detect_sector_checked(sector, size_available, trackMode, &checks);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Classify count contiguous 2352-byte sectors, same results as calling
+// detect_sector on each of them
+//
+void detect_sectors(
+	const uint8_t* sectors,
+	size_t count,
+	SectorType* out,
+	TrackMode* modes
+) {
+	size_t i;
+	for (i = 0; i < count; i++) {
+		sector_checks checks = { SECTOR_CHECK_PENDING, SECTOR_CHECK_PENDING, SECTOR_CHECK_PENDING, 0 };
+		out[i] = detect_sector_checked(sectors + i * 2352, 2352, modes ? &modes[i] : NULL, &checks);
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Reconstruct a sector based on type
@@ -486,3 +1174,206 @@ bool reconstruct_sector(
 	//
 	return true;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Error correction
+//
+// Every P column (26 bytes) and Q column (45 bytes) is a Reed-Solomon
+// codeword with two parity bytes: S0, the sum of its bytes, and S1, their
+// sum weighted by alpha^(n - 1 - position), are zero when it is intact. On
+// its own a column can locate and fix one bad byte, or fix two bytes whose
+// positions are known (erasures). Each byte sits in exactly one P and one Q
+// column, so the columns that one direction couldn't fix give the other
+// direction its erasures, and the passes alternate until nothing changes.
+//
+#define ECC_CORRECT_SIZE   (ECC_CODEWORD_SIZE + 0x68)
+#define ECC_CORRECT_PASSES 8
+
+typedef struct _ecc_correct_columns {
+	uint16_t p[86][26];
+	uint16_t q[52][45];
+} ecc_correct_columns;
+
+static constexpr ecc_correct_columns ecc_correct_make_columns(void) {
+	ecc_correct_columns columns = {};
+	for (size_t major = 0; major < 86; major++) {
+		for (size_t minor = 0; minor < 26; minor++) {
+			columns.p[major][minor] = (uint16_t)(major + 86 * minor);
+		}
+	}
+	for (size_t major = 0; major < 52; major++) {
+		size_t index = (major >> 1) * 86 + (major & 1);
+		for (size_t minor = 0; minor < 43; minor++) {
+			columns.q[major][minor] = (uint16_t)index;
+			index = (index + 88) % ECC_CODEWORD_SIZE;
+		}
+		columns.q[major][43] = (uint16_t)(ECC_CODEWORD_SIZE + major);
+		columns.q[major][44] = (uint16_t)(ECC_CODEWORD_SIZE + 52 + major);
+	}
+	return columns;
+}
+
+static constexpr ecc_correct_columns ecc_columns = ecc_correct_make_columns();
+
+//
+// Returns 0 if the column is intact, 1 if it was corrected and -1 if it
+// couldn't be
+// The first locked bytes of the codeword must not change (the zero address
+// of Mode 2)
+//
+static int ecc_correct_column(
+	uint8_t* codeword,
+	const uint16_t* column,
+	size_t count,
+	const uint8_t* erased,
+	size_t locked
+) {
+	uint8_t s0 = 0;
+	uint8_t s1 = 0;
+	size_t erasures[2];
+	size_t erasure_count = 0;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		uint8_t value = codeword[column[i]];
+		s0 ^= value;
+		s1 = ecc_f_lut[s1] ^ value;
+		if (erased[column[i]]) {
+			if (erasure_count < 2) {
+				erasures[erasure_count] = i;
+			}
+			erasure_count++;
+		}
+	}
+	if (!s0 && !s1) {
+		return 0;
+	}
+
+	if (erasure_count == 2) {
+		//
+		// e0 + e1 = S0 and x0 e0 + x1 e1 = S1, with x = alpha^(n - 1 - position)
+		//
+		size_t x0 = ecc_exp_lut[count - 1 - erasures[0]];
+		size_t x1 = ecc_exp_lut[count - 1 - erasures[1]];
+		uint8_t numerator = s1;
+		if (s0) {
+			numerator ^= ecc_exp_lut[ecc_log_lut[s0] + count - 1 - erasures[1]];
+		}
+		if (numerator && column[erasures[0]] >= locked && column[erasures[1]] >= locked) {
+			uint8_t e0 = ecc_exp_lut[ecc_log_lut[numerator] + 255 - ecc_log_lut[x0 ^ x1]];
+			codeword[column[erasures[0]]] ^= e0;
+			codeword[column[erasures[1]]] ^= e0 ^ s0;
+			return 1;
+		}
+	}
+
+	//
+	// A single error of size S0 at the position where S1 = x S0
+	//
+	if (s0 && s1) {
+		size_t position = (255 + ecc_log_lut[s0] - ecc_log_lut[s1]) % 255 + count - 1;
+		if (position >= 255) {
+			position -= 255;
+		}
+		if (position < count && column[position] >= locked) {
+			codeword[column[position]] ^= s0;
+			return 1;
+		}
+	}
+	return -1;
+}
+
+//
+// Correct a Mode 1 or Mode 2 Form 1 sector in place
+// Returns true if the sector's ECC and EDC match afterwards; otherwise the
+// sector is left as it was
+// Neither covers the sync (the EDC of Mode 1 only as the fixed pattern), so
+// it's put back as the pattern once the rest of the sector has been shown to
+// be data
+//
+bool correct_sector(
+	uint8_t* sector // must point to a full 2352-byte sector
+) {
+	uint8_t codeword[ECC_CORRECT_SIZE];
+	uint8_t erased_p[ECC_CORRECT_SIZE];
+	uint8_t erased_q[ECC_CORRECT_SIZE];
+	size_t locked;
+	size_t pass;
+	size_t i;
+
+	if ((sector[0x00F] & 0x0f) == 0x01) {
+		memcpy(codeword, sector + 0xC, 4);
+		locked = 0;
+	}
+	else if ((sector[0x00F] & 0x0f) == 0x02) {
+		memcpy(codeword, zeroaddress, 4);
+		locked = 4;
+	}
+	else {
+		return false;
+	}
+	memcpy(codeword + 4, sector + 0x10, ECC_CORRECT_SIZE - 4);
+	memset(erased_q, 0, sizeof(erased_q));
+
+	for (pass = 0; pass < ECC_CORRECT_PASSES; pass++) {
+		int corrected = 0;
+		int failed = 0;
+
+		memset(erased_p, 0, sizeof(erased_p));
+		for (i = 0; i < 86; i++) {
+			int result = ecc_correct_column(codeword, ecc_columns.p[i], 26, erased_q, locked);
+			if (result < 0) {
+				size_t k;
+				for (k = 0; k < 26; k++) {
+					erased_p[ecc_columns.p[i][k]] = 1;
+				}
+				failed++;
+			}
+			corrected += result > 0;
+		}
+
+		memset(erased_q, 0, sizeof(erased_q));
+		for (i = 0; i < 52; i++) {
+			int result = ecc_correct_column(codeword, ecc_columns.q[i], 45, erased_p, locked);
+			if (result < 0) {
+				size_t k;
+				for (k = 0; k < 45; k++) {
+					erased_q[ecc_columns.q[i][k]] = 1;
+				}
+				failed++;
+			}
+			corrected += result > 0;
+		}
+
+		if (!corrected) {
+			if (failed) {
+				return false;
+			}
+			break;
+		}
+	}
+
+	//
+	// The EDC catches a miscorrection that happens to satisfy the ECC
+	//
+	if (!ecc_checksector(codeword, codeword + 4, codeword + 4 + 0x80C)) {
+		return false;
+	}
+	if (locked) {
+		if (edc_compute(0, codeword + 4, 0x808) != get32lsb(codeword + 4 + 0x808)) {
+			return false;
+		}
+	}
+	else {
+		uint32_t edc = edc_compute(0, syncpattern, sizeof(syncpattern));
+		edc = edc_compute(edc, codeword, 0x810 - 0xC);
+		if (edc != get32lsb(codeword + 0x810 - 0xC)) {
+			return false;
+		}
+		memcpy(sector + 0xC, codeword, 4);
+	}
+	memcpy(sector, syncpattern, sizeof(syncpattern));
+	memcpy(sector + 0x10, codeword + 4, ECC_CORRECT_SIZE - 4);
+	return true;
+}
@@ -39,7 +39,16 @@ typedef unsigned short uint16_t;
 
 void eccedc_init(void);
 SectorType detect_sector(const uint8_t* sector, size_t size_available, TrackMode *trackMode);
+void detect_sectors(
+	const uint8_t* sectors, // count contiguous 2352-byte sectors
+	size_t count,
+	SectorType* out,
+	TrackMode* modes        // may be NULL
+);
 bool reconstruct_sector(
 	uint8_t* sector, // must point to a full 2352-byte sector
 	SectorType type
 );
+bool correct_sector(
+	uint8_t* sector  // must point to a full 2352-byte sector
+);